@@ -0,0 +1,50 @@
+#include <linux/limits.h> // PATH_MAX
+#include <stdio.h> // snprintf()
+#include <string.h>
+#include <unistd.h> // getcwd(), read(), write()
+#include "debug.h"
+#include "server.h"
+
+const char* ERROR = "An ERROR has occurred\n";
+
+static int log_error(void) {
+    write(STDERR_FILENO, ERROR, strlen(ERROR));
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    // usage: mysh-client <socket> [script]
+    if (argc < 2 || argc > 3) {
+        printf_debug("DEBUG: Expected a socket path and an optional script\n");
+        return log_error();
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof cwd) == NULL) {
+        printf_debug("DEBUG: getcwd() failed\n");
+        return log_error();
+    }
+    char msg[SERVER_MSG_MAX];
+    char const* script = argc == 3 ? argv[2] : "";
+    int len = snprintf(msg, sizeof msg, "%s%c%s", cwd, '\0', script);
+    if (len < 0 || (size_t)len + 1 > sizeof msg) {
+        printf_debug("DEBUG: Request too long\n");
+        return log_error();
+    }
+
+    int sock = server_connect(argv[1]);
+    if (sock < 0)
+        return log_error();
+    int const fds[SERVER_NFDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    if (send_request(sock, fds, msg, len + 1) < 0)
+        return log_error();
+
+    // the server runs the shell on our stdio, wait for its exit status
+    int status = 0;
+    if (read(sock, &status, sizeof status) != sizeof status) {
+        printf_debug("DEBUG: Server closed the connection without an exit status\n");
+        return log_error();
+    }
+    close(sock);
+    return status;
+}
@@ -0,0 +1,389 @@
+#include <linux/limits.h> // PATH_MAX
+#include <dirent.h> // opendir(), readdir()
+#include <fcntl.h> // AT_FDCWD
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // getenv(), malloc(), realloc(), free()
+#include <string.h>
+#include <sys/stat.h> // stat(), fstatat()
+#include <unistd.h> // faccessat(), write()
+#include "complete.h"
+#include "debug.h"
+#include "exec.h"
+#include "journal.h" // journal_hash()
+
+/*
+    Command names (builtins and every executable on $PATH) are kept in a prefix trie whose nodes
+    live in one array and link to their first child and next sibling by index. The trie is built on
+    a background thread so the first prompt is never delayed, and rebuilt whenever $PATH or the
+    modification time of one of its directories changes.
+*/
+
+struct trie_node {
+    uint32_t child;   // first child, 0 if none (the root is never a child)
+    uint32_t sibling; // next sibling, 0 if none
+    char ch;
+    bool terminal;    // a command name ends here
+};
+
+struct trie {
+    struct trie_node* nodes;
+    uint32_t len;
+    uint32_t cap;
+};
+
+static pthread_mutex_t commands_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trie* commands = NULL;  // NULL until the first build finished
+static bool building = false;
+static uint64_t built_signature = 0;  // signature of $PATH the current trie was built from
+
+// cached listing of the last directory used for file completion
+static struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char** names;
+    size_t len;
+} dir_cache = {0};
+
+// TRIE
+static struct trie* trie_new(void) {
+    struct trie* trie = malloc(sizeof *trie);
+    if (trie == NULL)
+        return NULL;
+    trie->cap = 1024;
+    trie->len = 1;
+    trie->nodes = malloc(trie->cap * sizeof *trie->nodes);
+    if (trie->nodes == NULL) {
+        free(trie);
+        return NULL;
+    }
+    trie->nodes[0] = (struct trie_node){0};
+    return trie;
+}
+
+static void trie_free(struct trie* trie) {
+    if (trie == NULL)
+        return;
+    free(trie->nodes);
+    free(trie);
+}
+
+static uint32_t trie_child(struct trie const* trie, uint32_t node, char ch) {
+    for (uint32_t child = trie->nodes[node].child; child != 0; child = trie->nodes[child].sibling) {
+        if (trie->nodes[child].ch == ch)
+            return child;
+    }
+    return 0;
+}
+
+static int trie_insert(struct trie* trie, char const* word) {
+    uint32_t node = 0;
+    for (; *word != '\0'; ++word) {
+        uint32_t next = trie_child(trie, node, *word);
+        if (next == 0) {
+            if (trie->len == trie->cap) {
+                struct trie_node* nodes = realloc(trie->nodes, 2 * trie->cap * sizeof *nodes);
+                if (nodes == NULL)
+                    return -1;
+                trie->nodes = nodes;
+                trie->cap *= 2;
+            }
+            next = trie->len++;
+            trie->nodes[next] = (struct trie_node){
+                .child = 0, .sibling = trie->nodes[node].child, .ch = *word, .terminal = false
+            };
+            trie->nodes[node].child = next;
+        }
+        node = next;
+    }
+    trie->nodes[node].terminal = true;
+    return 0;
+}
+
+static void trie_list(struct trie const* trie, uint32_t node, char* word, size_t len, unsigned* count) {
+    // prints the names below 'node', 'word' holds the 'len' chars leading to it
+    if (*count >= COMPLETE_LIST_MAX || len >= PATH_MAX - 1)
+        return;
+    if (trie->nodes[node].terminal) {
+        write(STDOUT_FILENO, word, len);
+        write(STDOUT_FILENO, "  ", 2);
+        ++*count;
+    }
+    for (uint32_t child = trie->nodes[node].child; child != 0; child = trie->nodes[child].sibling) {
+        word[len] = trie->nodes[child].ch;
+        trie_list(trie, child, word, len + 1, count);
+    }
+}
+
+// BUILDING
+static uint64_t path_signature(void) {
+    // hash of $PATH followed by the modification time of each of its directories
+    char const* path = getenv("PATH");
+    if (path == NULL)
+        return journal_hash("");
+    size_t dirs_len = 1;
+    for (char const* pos = path; *pos != '\0'; ++pos)
+        dirs_len += *pos == ':';
+
+    size_t const mtime_len = 42; // ":<seconds>.<nanoseconds>"
+    char signature[strlen(path) + dirs_len * mtime_len + 1];
+    size_t len = strlen(path);
+    memcpy(signature, path, len);
+    char dirs[strlen(path) + 1];
+    strcpy(dirs, path);
+    char* saveptr;
+    for (char* dir = strtok_r(dirs, ":", &saveptr); dir != NULL; dir = strtok_r(NULL, ":", &saveptr)) {
+        struct stat st;
+        if (stat(dir, &st) == -1)
+            continue;
+        len += snprintf(signature + len, mtime_len + 1, ":%lld.%ld", (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+    }
+    signature[len] = '\0';
+    return journal_hash(signature);
+}
+
+static void* build_commands(void* arg) {
+    uint64_t const signature = path_signature();
+    struct trie* trie = trie_new();
+    bool failed = trie == NULL;
+    for (int i = 0; !failed && BUILTINS[i] != NULL; i++)
+        failed = trie_insert(trie, *BUILTINS[i]) < 0;
+
+    char const* path = getenv("PATH");
+    char dirs[path != NULL ? strlen(path) + 1 : 1];
+    strcpy(dirs, path != NULL ? path : "");
+    char* saveptr;
+    for (char* dir = strtok_r(dirs, ":", &saveptr); !failed && dir != NULL; dir = strtok_r(NULL, ":", &saveptr)) {
+        DIR* stream = opendir(dir);
+        if (stream == NULL)
+            continue;
+        struct dirent* entry;
+        while (!failed && (entry = readdir(stream)) != NULL) {
+            struct stat st;
+            if (
+                entry->d_name[0] == '.' ||
+                fstatat(dirfd(stream), entry->d_name, &st, 0) == -1 ||
+                !S_ISREG(st.st_mode) ||
+                faccessat(dirfd(stream), entry->d_name, X_OK, 0) == -1
+            )
+                continue;
+            failed = trie_insert(trie, entry->d_name) < 0;
+        }
+        closedir(stream);
+    }
+    if (failed) {
+        printf_debug("DEBUG: Could not build command trie\n");
+        trie_free(trie);
+        trie = NULL;
+    }
+
+    pthread_mutex_lock(&commands_lock);
+    if (trie != NULL) {
+        trie_free(commands);
+        commands = trie;
+        built_signature = signature;
+    }
+    building = false;
+    pthread_mutex_unlock(&commands_lock);
+    return NULL;
+}
+
+static void start_build(void) {
+    // must hold commands_lock
+    pthread_t thread;
+    if (building)
+        return;
+    if (pthread_create(&thread, NULL, build_commands, NULL) != 0) {
+        printf_debug("DEBUG: pthread_create() failed\n");
+        return;
+    }
+    pthread_detach(thread);
+    building = true;
+}
+
+void complete_init(void) {
+    pthread_mutex_lock(&commands_lock);
+    start_build();
+    pthread_mutex_unlock(&commands_lock);
+}
+
+// COMPLETION
+static int complete_cmd(char* word, size_t max_len, bool list) {
+    /* RETURN VALUE
+        number of candidates (capped at 2), 'word' is extended by their common prefix
+    */
+    uint64_t const signature = path_signature();
+    pthread_mutex_lock(&commands_lock);
+    if (signature != built_signature)
+        start_build(); // completes against the old trie until the new one is ready
+    struct trie const* trie = commands;
+    if (trie == NULL) {
+        pthread_mutex_unlock(&commands_lock);
+        return 0;
+    }
+
+    uint32_t node = 0;
+    for (char const* pos = word; *pos != '\0'; ++pos) {
+        node = trie_child(trie, node, *pos);
+        if (node == 0) {
+            pthread_mutex_unlock(&commands_lock);
+            return 0;
+        }
+    }
+
+    // extend while there is exactly one way to go
+    size_t len = strlen(word);
+    while (!trie->nodes[node].terminal && trie->nodes[node].child != 0 && trie->nodes[trie->nodes[node].child].sibling == 0 && len < max_len) {
+        node = trie->nodes[node].child;
+        word[len++] = trie->nodes[node].ch;
+        word[len] = '\0';
+    }
+    int res = trie->nodes[node].child == 0 ? 1 : 2;
+    if (res == 1 && len < max_len) {
+        word[len++] = ' ';
+        word[len] = '\0';
+    } else if (res == 2 && list) {
+        char buf[PATH_MAX];
+        unsigned count = 0;
+        memcpy(buf, word, len);
+        write(STDOUT_FILENO, "\n", 1);
+        trie_list(trie, node, buf, len, &count);
+        write(STDOUT_FILENO, "\n", 1);
+    }
+    pthread_mutex_unlock(&commands_lock);
+    return res;
+}
+
+static int read_dir(char const* dir) {
+    // refreshes dir_cache if 'dir' is not the cached directory or changed since it was listed
+    struct stat st;
+    if (stat(dir, &st) == -1)
+        return -1;
+    if (
+        dir_cache.names != NULL &&
+        dir_cache.dev == st.st_dev && dir_cache.ino == st.st_ino &&
+        dir_cache.mtime.tv_sec == st.st_mtim.tv_sec && dir_cache.mtime.tv_nsec == st.st_mtim.tv_nsec
+    )
+        return 0;
+
+    DIR* stream = opendir(dir);
+    if (stream == NULL)
+        return -1;
+    for (size_t i = 0; i < dir_cache.len; i++)
+        free(dir_cache.names[i]);
+    dir_cache.len = 0;
+    size_t cap = 0;
+    struct dirent* entry;
+    while ((entry = readdir(stream)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        if (dir_cache.len == cap) {
+            cap = cap == 0 ? 64 : 2 * cap;
+            char** names = realloc(dir_cache.names, cap * sizeof *names);
+            if (names == NULL)
+                break;
+            dir_cache.names = names;
+        }
+        char* name = strdup(entry->d_name);
+        if (name == NULL)
+            break;
+        dir_cache.names[dir_cache.len++] = name;
+    }
+    closedir(stream);
+    if (dir_cache.names == NULL)
+        dir_cache.names = malloc(sizeof *dir_cache.names); // an empty listing is still cached
+    dir_cache.dev = st.st_dev;
+    dir_cache.ino = st.st_ino;
+    dir_cache.mtime = st.st_mtim;
+    return 0;
+}
+
+static int complete_file(char* word, size_t max_len, bool list) {
+    // same as complete_cmd() for file names, a unique directory gets a trailing '/'
+    char dir[PATH_MAX] = ".";
+    char* base = strrchr(word, '/');
+    if (base == NULL) {
+        base = word;
+    } else {
+        ++base;
+        snprintf(dir, sizeof dir, "%.*s", (int)(base - word), word);
+    }
+    if (read_dir(dir) < 0)
+        return 0;
+
+    size_t const base_len = strlen(base);
+    char const* first = NULL;
+    size_t common = 0; // length of the common prefix of the candidates
+    int count = 0;
+    for (size_t i = 0; i < dir_cache.len; i++) {
+        char const* name = dir_cache.names[i];
+        if (strncmp(name, base, base_len) != 0 || (name[0] == '.' && base[0] != '.'))
+            continue;
+        if (first == NULL) {
+            first = name;
+            common = strlen(name);
+        } else {
+            size_t j = base_len;
+            while (j < common && name[j] == first[j])
+                ++j;
+            common = j;
+        }
+        ++count;
+    }
+    if (count == 0)
+        return 0;
+
+    size_t len = strlen(word);
+    for (size_t i = base_len; i < common && len < max_len; i++)
+        word[len++] = first[i];
+    word[len] = '\0';
+    if (count == 1 && len < max_len) {
+        struct stat st;
+        char path[PATH_MAX];
+        int path_len = snprintf(path, sizeof path, "%s/%s", dir, first);
+        bool is_dir = path_len > 0 && (size_t)path_len < sizeof path && stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+        word[len++] = is_dir ? '/' : ' ';
+        word[len] = '\0';
+    } else if (count > 1 && list) {
+        write(STDOUT_FILENO, "\n", 1);
+        unsigned listed = 0;
+        for (size_t i = 0; i < dir_cache.len && listed < COMPLETE_LIST_MAX; i++) {
+            char const* name = dir_cache.names[i];
+            if (strncmp(name, base, base_len) != 0 || (name[0] == '.' && base[0] != '.'))
+                continue;
+            write(STDOUT_FILENO, name, strlen(name));
+            write(STDOUT_FILENO, "  ", 2);
+            ++listed;
+        }
+        write(STDOUT_FILENO, "\n", 1);
+    }
+    return count > 1 ? 2 : 1;
+}
+
+int complete(char* line, size_t max_len, bool list) {
+    /* Completes the last word of 'line' in place (up to 'max_len' chars), as a command name if it is
+       the first word of a cmd and a file name otherwise. With 'list' the candidates of an ambiguous
+       completion are printed on a new line.
+
+       RETURN VALUE
+        0 - no candidates
+        1 - unique completion
+        2 - more than one candidate
+    */
+    char* word = line;
+    for (char* pos = line; *pos != '\0'; ++pos) {
+        if (strchr(" \t;&|>", *pos) != NULL)
+            word = pos + 1;
+    }
+    char const* prev = word;
+    while (prev > line && (prev[-1] == ' ' || prev[-1] == '\t'))
+        --prev;
+    bool const cmd_word = prev == line || strchr(";&|", prev[-1]) != NULL;
+    size_t const word_max = max_len - (word - line);
+    if (cmd_word && strchr(word, '/') == NULL)
+        return complete_cmd(word, word_max, list);
+    return complete_file(word, word_max, list);
+}
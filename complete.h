@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define COMPLETE_LIST_MAX 100 // candidates printed for an ambiguous completion
+
+void complete_init(void);
+int complete(char* line, size_t max_len, bool list);
@@ -0,0 +1,5 @@
+#include "debug.h"
+
+#ifdef DEBUG
+__thread FILE* debug_stream = NULL;
+#endif
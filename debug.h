@@ -2,7 +2,8 @@
 
 #ifdef DEBUG
     #include <stdio.h>
-    #define printf_debug(fmt, ...) do { fprintf(stderr, fmt, ##__VA_ARGS__); } while (0)
+    extern __thread FILE* debug_stream; // diagnostics of the calling thread go here, stderr if NULL
+    #define printf_debug(fmt, ...) do { fprintf(debug_stream != NULL ? debug_stream : stderr, fmt, ##__VA_ARGS__); } while (0)
 #else
     #define printf_debug(...) do {} while (0)
 #endif
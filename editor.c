@@ -0,0 +1,105 @@
+#include <stdbool.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h> // isatty(), read(), write()
+#include "complete.h"
+#include "debug.h"
+#include "editor.h"
+
+#define KEY_CTRL_C    3
+#define KEY_CTRL_D    4
+#define KEY_BACKSPACE 8
+#define KEY_TAB       '\t'
+#define KEY_ESCAPE    27
+#define KEY_DELETE    127
+
+bool editor_enabled(void) {
+    return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+}
+
+static void skip_escape_sequence(void) {
+    // arrow keys etc. are "ESC [ ... final" or "ESC O final", none of them are supported
+    char ch;
+    if (read(STDIN_FILENO, &ch, 1) != 1 || (ch != '[' && ch != 'O'))
+        return;
+    do {
+        if (read(STDIN_FILENO, &ch, 1) != 1)
+            return;
+    } while (ch < 0x40 || ch > 0x7e);
+}
+
+char* editor_read(char const* prompt, char* buf, size_t len) {
+    /* Reads a line from the terminal in raw mode, like fgets() the line ends with '\n' and NULL
+       is returned at end of input. At most len-2 chars can be typed, TAB completes the last word
+       and a second TAB lists the candidates.
+    */
+    struct termios saved;
+    if (tcgetattr(STDIN_FILENO, &saved) == -1) {
+        printf_debug("DEBUG: tcgetattr() failed\n");
+        return NULL;
+    }
+    struct termios raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+    char* res = buf;
+    size_t used = 0;
+    bool tabbed = false; // previous key was a TAB that could not complete anything
+    buf[0] = '\0';
+    while (true) {
+        char ch;
+        bool const list = tabbed;
+        tabbed = false;
+        if (read(STDIN_FILENO, &ch, 1) != 1) {
+            res = NULL;
+            break;
+        }
+        if (ch == '\r' || ch == '\n') {
+            write(STDOUT_FILENO, "\n", 1);
+            buf[used++] = '\n';
+            buf[used] = '\0';
+            break;
+        } else if (ch == KEY_CTRL_D && used == 0) {
+            write(STDOUT_FILENO, "\n", 1);
+            res = NULL;
+            break;
+        } else if (ch == KEY_CTRL_C) {
+            // discard the line
+            used = 0;
+            buf[0] = '\0';
+            write(STDOUT_FILENO, "\n", 1);
+            write(STDOUT_FILENO, prompt, strlen(prompt));
+        } else if (ch == KEY_DELETE || ch == KEY_BACKSPACE) {
+            if (used > 0) {
+                buf[--used] = '\0';
+                write(STDOUT_FILENO, "\b \b", 3);
+            }
+        } else if (ch == KEY_TAB) {
+            size_t const before = used;
+            int const candidates = complete(buf, len - 2, list);
+            used = strlen(buf);
+            if (candidates > 1 && list) {
+                // candidates were listed, redraw the line below them
+                write(STDOUT_FILENO, prompt, strlen(prompt));
+                write(STDOUT_FILENO, buf, used);
+            } else if (used > before) {
+                write(STDOUT_FILENO, buf + before, used - before);
+            } else {
+                write(STDOUT_FILENO, "\a", 1);
+                tabbed = true;
+            }
+        } else if (ch == KEY_ESCAPE) {
+            skip_escape_sequence();
+        } else if ((unsigned char)ch >= ' ' && used < len - 2) {
+            buf[used++] = ch;
+            buf[used] = '\0';
+            write(STDOUT_FILENO, &ch, 1);
+        } else {
+            write(STDOUT_FILENO, "\a", 1);
+        }
+    }
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+    return res;
+}
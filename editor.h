@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool editor_enabled(void);
+char* editor_read(char const* prompt, char* buf, size_t len);
@@ -1,28 +1,43 @@
 #define EXIT_BYE 10
 #define EXIT_ON_FAILURE 11 // to distinguish from programs that return 1 upon success
+#define MAX_NODES 64 // NUMA nodes considered for placement
+#define _GNU_SOURCE // sched_setaffinity(), CPU_* macros
 
 #include <linux/limits.h> // PATH_MAX
 #include <fcntl.h> // open()
+#include <sched.h> // sched_getaffinity(), sched_setaffinity()
 #include <stdbool.h>
-#include <stdlib.h> // exit(), getenv()
+#include <stdio.h> // fopen(), fgets(), snprintf()
+#include <stdlib.h> // exit(), getenv(), strtol()
 #include <string.h>
 #include <sys/stat.h>  // S_IRWXU
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h> // getcwd(), chdir(), fork(), execvp(), write()
 #include "debug.h"
+#include "exec.h"
+#include "history.h"
 
 const char* CMD_CD   = "cd";
 const char* CMD_ECHO = "echo";
 const char* CMD_PWD  = "pwd";
 const char* CMD_QUIT = "bye";
+const char* CMD_PARALLEL = "parallel";
+const char* CMD_HISTORY  = "history";
+const char** const BUILTINS[] = {&CMD_CD, &CMD_ECHO, &CMD_PWD, &CMD_QUIT, &CMD_PARALLEL, &CMD_HISTORY, NULL};
+const char* PARALLEL_ARG = "{}"; // replaced by the input line
+
+const char* ENV_PLACEMENT        = "MYSH_PLACEMENT"; // placement policy for parallel jobs
+const char* PLACEMENT_ROUNDROBIN = "roundrobin"; // one cpu per job, round-robin over the allowed cpus
+const char* PLACEMENT_COMPACT    = "compact";    // one cpu per job, lowest node's cpus first
+const char* PLACEMENT_SPREAD     = "spread";     // one NUMA node per job, round-robin over the nodes
 
 static int exit_status(int status) {
     int res = 0;
     if (WEXITSTATUS(status) == EXIT_ON_FAILURE)
         res = -1;
     else if (WEXITSTATUS(status) == EXIT_BYE)
-        exit(EXIT_SUCCESS);
+        res = EXEC_BYE; // the shell ends after the line, on its normal return path
     return res;
 }
 
@@ -81,7 +96,7 @@ static int setup_pipe_parent(int pipefd[2], int* restore_stdin, int* restore_std
         printf_debug("DEBUG: pipe() failed\n");
     } else {
         *restore_stdin = dup(STDIN_FILENO);
-        *restore_stdout = dup(STDIN_FILENO);
+        *restore_stdout = dup(STDOUT_FILENO);
         if (*restore_stdin == -1 || *restore_stdout == -1) {
             printf_debug("DEBUG: dup() failed\n");
             res = -1;
@@ -114,21 +129,163 @@ static int restore_stdio(int restore_stdin, int restore_stdout) {
     return success;
 }
 
+// CPU PLACEMENT
+static int read_node_cpus(int node, cpu_set_t* cpus) {
+    // parses /sys/devices/system/node/node<N>/cpulist, e.g. "0-3,8-11"
+    char path[PATH_MAX];
+    snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    char buf[4096] = {0};
+    char* line = fgets(buf, sizeof buf, file);
+    fclose(file);
+    if (line == NULL)
+        return -1;
+
+    CPU_ZERO(cpus);
+    char* pos = line;
+    while (*pos != '\0' && *pos != '\n') {
+        char* end;
+        long first = strtol(pos, &end, 10);
+        long last = first;
+        if (end == pos)
+            return -1;
+        if (*end == '-')
+            last = strtol(end+1, &end, 10);
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, cpus);
+        pos = *end == ',' ? end+1 : end;
+    }
+    return 0;
+}
+
+static int read_nodes(cpu_set_t nodes[], int max, cpu_set_t const* allowed) {
+    // only consider nodes which share at least one cpu with the shell's own mask
+    int count = 0;
+    for (int node = 0; node < MAX_NODES && count < max; node++) {
+        cpu_set_t cpus;
+        if (read_node_cpus(node, &cpus) < 0)
+            continue;
+        CPU_AND(&nodes[count], &cpus, allowed);
+        if (CPU_COUNT(&nodes[count]) > 0)
+            ++count;
+    }
+    return count;
+}
+
+static int nth_cpu(cpu_set_t const* cpus, int n) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, cpus) && n-- == 0)
+            return cpu;
+    }
+    return -1;
+}
+
+static void place_roundrobin(int job, cpu_set_t const* allowed, cpu_set_t* target) {
+    // one cpu per job, in cpu number order
+    CPU_ZERO(target);
+    CPU_SET(nth_cpu(allowed, job % CPU_COUNT(allowed)), target);
+}
+
+static void place_compact(int job, cpu_set_t const* allowed, cpu_set_t* target) {
+    // one cpu per job, filling the cpus of the lowest node before moving on to the next node
+    cpu_set_t nodes[MAX_NODES];
+    int const count = read_nodes(nodes, MAX_NODES, allowed);
+    cpu_set_t rest; // allowed cpus without a node (all of them on a non-NUMA host)
+    CPU_ZERO(&rest);
+    CPU_OR(&rest, &rest, allowed);
+    for (int i = 0; i < count; i++)
+        CPU_XOR(&rest, &rest, &nodes[i]);
+
+    int n = job % CPU_COUNT(allowed);
+    CPU_ZERO(target);
+    for (int i = 0; i < count; i++) {
+        if (n < CPU_COUNT(&nodes[i])) {
+            CPU_SET(nth_cpu(&nodes[i], n), target);
+            return;
+        }
+        n -= CPU_COUNT(&nodes[i]);
+    }
+    CPU_SET(nth_cpu(&rest, n), target);
+}
+
+static void place_spread(int job, cpu_set_t const* allowed, cpu_set_t* target) {
+    // one NUMA node per job, round-robin over the nodes
+    cpu_set_t nodes[MAX_NODES];
+    int const count = read_nodes(nodes, MAX_NODES, allowed);
+    if (count == 0) {
+        CPU_ZERO(target);
+        CPU_OR(target, target, allowed); // not a NUMA host
+    } else {
+        CPU_ZERO(target);
+        CPU_OR(target, target, &nodes[job % count]);
+    }
+}
+
+static void report_placement(int job, cpu_set_t const* cpus) {
+    // "job <N> -> cpus 0-3,8" on stderr, there is no jobs listing to show it in
+    char buf[256];
+    int len = snprintf(buf, sizeof buf, "job %d -> cpus ", job);
+    char const* sep = "";
+    for (int cpu = 0; cpu < CPU_SETSIZE && len < (int)sizeof buf - 32; cpu++) {
+        if (!CPU_ISSET(cpu, cpus))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus))
+            ++last;
+        if (last == cpu)
+            len += snprintf(buf + len, sizeof buf - len, "%s%d", sep, cpu);
+        else
+            len += snprintf(buf + len, sizeof buf - len, "%s%d-%d", sep, cpu, last);
+        sep = ",";
+        cpu = last;
+    }
+    buf[len++] = '\n';
+    write(STDERR_FILENO, buf, len);
+}
+
+static void place_job(int job) {
+    // called in the child before exec, the parent's mask is inherited when no policy is set
+    char const* policy = getenv(ENV_PLACEMENT);
+    if (policy == NULL || *policy == '\0')
+        return;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof allowed, &allowed) == -1) {
+        printf_debug("DEBUG: sched_getaffinity() failed\n");
+        return;
+    }
+    cpu_set_t target;
+    if (strcmp(policy, PLACEMENT_ROUNDROBIN) == 0) {
+        place_roundrobin(job, &allowed, &target);
+    } else if (strcmp(policy, PLACEMENT_COMPACT) == 0) {
+        place_compact(job, &allowed, &target);
+    } else if (strcmp(policy, PLACEMENT_SPREAD) == 0) {
+        place_spread(job, &allowed, &target);
+    } else {
+        printf_debug("DEBUG: Unknown placement policy \"%s\"\n", policy);
+        return;
+    }
+    if (sched_setaffinity(0, sizeof target, &target) == -1)
+        printf_debug("DEBUG: sched_setaffinity() failed\n"); // not fatal, job still runs
+    else
+        report_placement(job, &target);
+}
+
 // BUILTIN COMMANDS
 bool is_builtin(char const* cmd) {
     if (cmd == NULL)
         return false;
-    else if (
-        strcmp(cmd, CMD_CD)   == 0 ||
-        strcmp(cmd, CMD_ECHO) == 0 ||
-        strcmp(cmd, CMD_PWD)  == 0 ||
-        strcmp(cmd, CMD_QUIT) == 0
-    )
-        return true;
-    else
-        return false;
+    for (int i = 0; BUILTINS[i] != NULL; i++) {
+        if (strcmp(cmd, *BUILTINS[i]) == 0)
+            return true;
+    }
+    return false;
 }
 
+static int builtin_parallel(char *const argv[]);
+
 static void builtin(char const* cmd, char *const argv[], char const redir_type) {
     int success = 0;
     if (strcmp(cmd, CMD_QUIT) == 0) {
@@ -161,6 +318,18 @@ static void builtin(char const* cmd, char *const argv[], char const redir_type)
                 write(STDOUT_FILENO, "\n", 1);
             }
         }
+    } else if (strcmp(cmd, CMD_HISTORY) == 0) {
+        // history [-r] [pattern]
+        bool const reverse = argv[1] != NULL && strcmp(argv[1], "-r") == 0;
+        char* pattern = reverse ? argv[2] : argv[1];
+        if (pattern != NULL && argv[reverse ? 3 : 2] != NULL) {
+            printf_debug("DEBUG: \"history\" failed, >1 pattern provided\n");
+            success = -1;
+        } else {
+            success = history_search(pattern, reverse);
+        }
+    } else if (strcmp(cmd, CMD_PARALLEL) == 0) {
+        success = builtin_parallel(argv);
     } else if (strcmp(cmd, CMD_CD) == 0) {
         // calling chdir is useless in child process, call builtin_chdir() in parent
         printf_debug("DEBUG: Invalid call to builtin(\"cd\"), call builtin_chdir() instead\n");
@@ -239,6 +408,114 @@ static void external(char const* cmd, char *const argv[]) {
     exit(EXIT_ON_FAILURE);
 }
 
+// PARALLEL BUILTIN
+static int wait_parallel_job(void) {
+    int status = 0;
+    if (wait(&status) == -1) {
+        printf_debug("DEBUG: wait() failed\n");
+        return -1;
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_ON_FAILURE) {
+        printf_debug("DEBUG: One or more parallel jobs failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int builtin_parallel(char *const argv[]) {
+    /* usage: parallel [-j N] [-a file] cmd [args] [{}]
+        Runs cmd once per line of stdin (or 'file') with "{}" replaced by the line, or the line
+        appended if there is no "{}". At most N jobs run at once and input is read one line at a
+        time as job slots free up, so memory use does not depend on the amount of input.
+    */
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1)
+        jobs = 1; // cpu count unknown, the job count still has to be bounded
+    char const* path = NULL;
+    int i = 1;
+    while (argv[i] != NULL && argv[i][0] == '-') {
+        if (strcmp(argv[i], "-j") == 0 && argv[i+1] != NULL) {
+            char* end;
+            jobs = strtol(argv[i+1], &end, 10);
+            if (*end != '\0' || jobs < 1) {
+                printf_debug("DEBUG: \"parallel\" failed, invalid job count: \"%s\"\n", argv[i+1]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-a") == 0 && argv[i+1] != NULL) {
+            path = argv[i+1];
+        } else {
+            printf_debug("DEBUG: \"parallel\" failed, unknown option: \"%s\"\n", argv[i]);
+            return -1;
+        }
+        i += 2;
+    }
+    char *const* cmd_argv = argv + i;
+    if (*cmd_argv == NULL) {
+        printf_debug("DEBUG: \"parallel\" failed, no cmd provided\n");
+        return -1;
+    }
+    int cmd_argc = 0;
+    bool has_arg = false;
+    while (cmd_argv[cmd_argc] != NULL)
+        has_arg |= strcmp(cmd_argv[cmd_argc++], PARALLEL_ARG) == 0;
+
+    FILE* input_src = path != NULL ? fopen(path, "r") : fdopen(dup(STDIN_FILENO), "r");
+    if (input_src == NULL) {
+        printf_debug("DEBUG: \"parallel\" failed, could not open input\n");
+        return -1;
+    }
+
+    int res = 0;
+    long running = 0;
+    long count = 0;
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_cap, input_src)) != -1) {
+        if (line_len > 0 && line[line_len-1] == '\n')
+            line[--line_len] = '\0';
+        if (line_len == 0)
+            continue; // skip empty lines
+
+        // wait for a free job slot
+        if (running == jobs) {
+            if (wait_parallel_job() < 0)
+                res = -1;
+            --running;
+        }
+
+        char* job_argv[cmd_argc + 2];
+        for (int j = 0; j < cmd_argc; j++)
+            job_argv[j] = strcmp(cmd_argv[j], PARALLEL_ARG) == 0 ? line : cmd_argv[j];
+        job_argv[cmd_argc] = has_arg ? NULL : line;
+        job_argv[cmd_argc + 1] = NULL;
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            printf_debug("DEBUG: fork() failed\n");
+            res = -1;
+            break;
+        } else if (pid == 0) {
+            // child, exit() would rewind the shared offset of a buffered input stream
+            close(fileno(input_src));
+            place_job(count);
+            if (is_builtin(job_argv[0]))
+                builtin(job_argv[0], job_argv, '\0');
+            else
+                external(job_argv[0], job_argv);
+        }
+        ++running;
+        ++count;
+    }
+    while (running-- > 0) {
+        if (wait_parallel_job() < 0)
+            res = -1;
+    }
+    free(line);
+    fclose(input_src);
+    return res;
+}
+
 int exec_extern(char const* cmd, char *const argv[], char const redir_type, char *const redir_argv[], int pipefd[2]) {
     int success = 0;
     pid_t pid = fork();
@@ -307,23 +584,53 @@ int exec_cmds_seq(char ***const cmds, size_t len, char const* redir_types, char
     int res = 0;
     for(int i=0; i<len; i++) {
         int success = exec_cmd(cmds[i], redir_types[i], redir_cmds[i]);
+        if (success == EXEC_BYE)
+            return success; // the cmds after "bye" never run
         if (success < 0)
             res = success;
     }
     return res;
 }
 
+static int wait_jobs(pid_t const* pids, size_t len) {
+    int res = 0;
+    bool bye = false;
+    int status = 0;
+    for(int i=0; i<len; i++) {
+        if (pids[i] > 0) {
+            wait(&status);
+            int success = exit_status(status); // if "bye" was entered shell will exit after the other cmds, this behaviour is different to a regular shell
+            if (success == EXEC_BYE) {
+                bye = true;
+            } else if (success == -1) {
+                printf_debug("DEBUG: One or more commands failed\n");
+                res = success;
+            }
+        } 
+    }
+    return bye ? EXEC_BYE : res;
+}
+
 int exec_cmds_par(char ***const cmds, size_t len, char const* redir_types, char ***const redir_cmds) {
     int res = 0;
     pid_t pids[len];
+    int barrier = 0; // index of the first cmd not yet waited for
     for(int i=0; i<len; i++) {
         char *const cmd = cmds[i][0];
+        pids[i] = 0;
+        if (cmd == NULL) // empty cmd, do nothing
+            continue;
 
-        // check if cmd is "cd" first
-        int chdir_success = builtin_chdir(cmd, cmds[i]);
-        if (chdir_success <= 0) {
-            // this "cd" behaviour in parallel mode is different to a regular shell
-            pids[i] = chdir_success;
+        // "cd" is a barrier, the cmds before it finish in the old directory and the cmds after it start in the new one
+        if (strcmp(cmd, CMD_CD) == 0) {
+            int waited = wait_jobs(pids + barrier, i - barrier);
+            if (waited == EXEC_BYE)
+                return waited; // the cmds after the barrier never start
+            if (waited < 0)
+                res = -1;
+            barrier = i + 1;
+            if (builtin_chdir(cmd, cmds[i]) < 0)
+                res = -1;
             continue;
         }
 
@@ -335,6 +642,7 @@ int exec_cmds_par(char ***const cmds, size_t len, char const* redir_types, char
             res = -1;
         } else if(pids[i] == 0) {
             // child
+            place_job(i);
             if (redir_types[i] == '|') {
                 int success = exec_cmd(cmds[i], redir_types[i], redir_cmds[i]);
                 if (success < 0)
@@ -354,16 +662,10 @@ int exec_cmds_par(char ***const cmds, size_t len, char const* redir_types, char
         }
     }
 
-    int status = 0;
-    for(int i=0; i<len; i++) {
-        if (pids[i] > 0) {
-            wait(&status);
-            int success = exit_status(status); // if "bye" was entered shell will exit here, this behaviour is different to a regular shell
-            if (success == -1) {
-                printf_debug("DEBUG: One or more commands failed\n");
-                res = success;
-            }
-        } 
-    }
+    int waited = wait_jobs(pids + barrier, len - barrier);
+    if (waited == EXEC_BYE)
+        return waited;
+    if (waited < 0)
+        res = -1;
     return res;
 }
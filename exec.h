@@ -1,9 +1,13 @@
 #pragma once
 
+#define EXEC_BYE 1 // returned by the exec_*() functions after "bye", the shell ends once the line is done
+
+extern const char** const BUILTINS[]; // names of the CMD_* builtins, NULL-terminated
+
 bool is_builtin(char const* cmd);
 
-int exec_builtin(char const* cmd, char *const argv[], char const redir_type, char *const redir_argv[]);
-int exec_extern(char const* cmd, char *const argv[], char const redir_type, char *const redir_argv[]);
+int exec_builtin(char const* cmd, char *const argv[], char const redir_type, char *const redir_argv[], int pipefd[2]);
+int exec_extern(char const* cmd, char *const argv[], char const redir_type, char *const redir_argv[], int pipefd[2]);
 
 int exec_cmd(char *const argv[], char const redir_type, char *const redir_argv[]);
 int exec_cmds_seq(char ***const cmds, size_t len, char const* redir_types, char ***const redir_cmds);
@@ -0,0 +1,530 @@
+#define _GNU_SOURCE // memmem(), memrchr(), rawmemchr()
+
+#include <linux/limits.h> // PATH_MAX
+#include <fcntl.h> // open()
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h> // snprintf(), rename()
+#include <stdlib.h> // getenv(), mkstemp(), malloc(), realloc(), free()
+#include <string.h>
+#include <sys/file.h> // flock()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
+#include <unistd.h> // write(), pread(), pwrite(), close(), unlink()
+#include "debug.h"
+#include "history.h"
+
+/*
+    Searches for a pattern of 3 or more bytes use a trigram index kept next to the history:
+
+        <header> <checkpoints> <lists> <tail posting> <tail posting> ...
+
+    Every trigram of a line is hashed to one of HISTORY_BUCKETS buckets, and the line is listed
+    once in each of its buckets. A search walks the bucket with the fewest lines among the
+    pattern's trigrams and checks each line it lists with memmem().
+
+    The lists hold the line numbers of each bucket as ascending deltas, one varint each, and the
+    checkpoints hold the offset of every HISTORY_CHECKPOINT-th line, so a line is found by
+    skipping at most HISTORY_CHECKPOINT-1 lines from there. Lines added since the lists were
+    written are appended as fixed size tail postings, linked from the newest one in the header.
+    Once the tail covers HISTORY_TAIL_MAX bytes of the history, or if the history was replaced
+    or truncated, the whole index is written again as lists to a new file that replaces it.
+
+    The history itself is flock()ed: exclusively while the index is extended or replaced, shared
+    while it is searched.
+*/
+
+#define INDEX_MAGIC "myshidx2"
+
+struct index_header {
+    char magic[8];
+    uint64_t inode;      // of the indexed history
+    uint64_t indexed;    // bytes of the history covered, always whole lines
+    uint64_t list_bytes; // bytes of the history covered by the lists
+    uint64_t tail_at;    // file offset of the first tail posting
+    uint32_t lines;      // lines covered
+    uint32_t list_lines; // lines covered by the lists
+    uint32_t records;    // tail postings
+    uint32_t checkpoints;
+    uint64_t list_end[HISTORY_BUCKETS];  // end of each bucket's list, from the start of the lists
+    uint32_t list_count[HISTORY_BUCKETS];
+    uint32_t tail_head[HISTORY_BUCKETS]; // newest tail posting of each bucket + 1, 0 if none
+    uint32_t tail_count[HISTORY_BUCKETS];
+};
+
+struct posting {
+    uint64_t offset; // of the line in the history
+    uint32_t number; // of the line, from 1
+    uint32_t next;   // older tail posting of the same bucket + 1, 0 if none
+};
+
+// buffered output, the shell writes to stdout through the file descriptor only
+struct output {
+    char buf[4096];
+    size_t len;
+};
+
+static void output_flush(struct output* out) {
+    for (size_t done = 0; done < out->len; ) {
+        ssize_t put = write(STDOUT_FILENO, out->buf + done, out->len - done);
+        if (put <= 0)
+            break;
+        done += put;
+    }
+    out->len = 0;
+}
+
+static void output_line(struct output* out, unsigned long number, char const* line, size_t len) {
+    // number is 0 to print the line alone
+    char prefix[32];
+    int prefix_len = number == 0 ? 0 : snprintf(prefix, sizeof prefix, "%5lu  ", number);
+    if (out->len + prefix_len + len + 1 > sizeof out->buf)
+        output_flush(out);
+    if (prefix_len + len + 1 > sizeof out->buf) {
+        // longer than the buffer (lines from other shells are not checked), write it directly
+        write(STDOUT_FILENO, prefix, prefix_len);
+        write(STDOUT_FILENO, line, len);
+        write(STDOUT_FILENO, "\n", 1);
+        return;
+    }
+    memcpy(out->buf + out->len, prefix, prefix_len);
+    memcpy(out->buf + out->len + prefix_len, line, len);
+    out->buf[out->len + prefix_len + len] = '\n';
+    out->len += prefix_len + len + 1;
+}
+
+static int history_path(char* buf, size_t len, char const* name) {
+    char const* home = getenv("HOME");
+    if (home == NULL) {
+        printf_debug("DEBUG: $HOME not set, history disabled\n");
+        return -1;
+    }
+    int res = snprintf(buf, len, "%s/%s", home, name);
+    return res < 0 || (size_t)res >= len ? -1 : 0;
+}
+
+int history_add(char const* line) {
+    // O_APPEND makes every line a single atomic append, shells running at the same time don't interleave
+    char path[PATH_MAX];
+    if (history_path(path, sizeof path, HISTORY_FILE) < 0)
+        return -1;
+    int filedesc = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (filedesc < 0) {
+        printf_debug("DEBUG: open(%s) failed\n", path);
+        return -1;
+    }
+    // the last line of the input may lack its '\n', the entry is still written in one go
+    char buf[PATH_MAX];
+    size_t len = strlen(line);
+    if (len == 0 || len + 1 >= sizeof buf) {
+        close(filedesc);
+        return -1;
+    }
+    memcpy(buf, line, len);
+    if (buf[len-1] != '\n')
+        buf[len++] = '\n';
+    int res = write(filedesc, buf, len) == (ssize_t)len ? 0 : -1;
+    close(filedesc);
+    return res;
+}
+
+static uint32_t trigram_bucket(char const* pos) {
+    uint32_t trigram = (unsigned char)pos[0] << 16 | (unsigned char)pos[1] << 8 | (unsigned char)pos[2];
+    return (trigram * 2654435761u) >> 20 & (HISTORY_BUCKETS - 1);
+}
+
+// INDEX WRITING
+struct list {
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+    uint32_t last; // line number of the last entry
+};
+
+static int list_append(struct list* list, uint32_t number) {
+    if (list->cap - list->len < 5) {
+        size_t cap = list->cap == 0 ? 64 : list->cap * 2;
+        uint8_t* data = realloc(list->data, cap);
+        if (data == NULL)
+            return -1;
+        list->data = data;
+        list->cap = cap;
+    }
+    for (uint32_t delta = number - list->last; ; delta >>= 7) {
+        if (delta < 0x80) {
+            list->data[list->len++] = delta;
+            break;
+        }
+        list->data[list->len++] = (delta & 0x7f) | 0x80;
+    }
+    list->last = number;
+    return 0;
+}
+
+static int write_all(int filedesc, void const* buf, size_t len) {
+    for (size_t done = 0; done < len; ) {
+        ssize_t put = write(filedesc, (char const*)buf + done, len - done);
+        if (put <= 0)
+            return -1;
+        done += put;
+    }
+    return 0;
+}
+
+static int write_lists(int filedesc, struct index_header* header, char const* history, uint64_t end) {
+    // indexes every whole line in history[0, end) as lists
+    struct list* lists = calloc(HISTORY_BUCKETS, sizeof *lists);
+    uint32_t* posted = calloc(HISTORY_BUCKETS, sizeof *posted); // line last listed in each bucket
+    uint64_t* checkpoints = NULL;
+    size_t checkpoints_cap = 0;
+    int res = lists == NULL || posted == NULL ? -1 : 0;
+
+    char const* line = history;
+    char const* nl;
+    while (res == 0 && (nl = memchr(line, '\n', history + end - line)) != NULL) {
+        if (header->lines % HISTORY_CHECKPOINT == 0) {
+            if (header->checkpoints == checkpoints_cap) {
+                checkpoints_cap = checkpoints_cap == 0 ? 1024 : checkpoints_cap * 2;
+                uint64_t* grown = realloc(checkpoints, checkpoints_cap * sizeof *checkpoints);
+                if (grown == NULL) {
+                    res = -1;
+                    break;
+                }
+                checkpoints = grown;
+            }
+            checkpoints[header->checkpoints++] = line - history;
+        }
+        ++header->lines;
+        for (char const* pos = line; pos + 3 <= nl && res == 0; ++pos) {
+            uint32_t bucket = trigram_bucket(pos);
+            if (posted[bucket] == header->lines)
+                continue;
+            posted[bucket] = header->lines;
+            res = list_append(&lists[bucket], header->lines);
+            ++header->list_count[bucket];
+        }
+        line = nl + 1;
+    }
+    header->indexed = header->list_bytes = line - history;
+    header->list_lines = header->lines;
+
+    uint64_t lists_len = 0;
+    for (size_t i = 0; i < HISTORY_BUCKETS && res == 0; i++) {
+        lists_len += lists[i].len;
+        header->list_end[i] = lists_len;
+    }
+    header->tail_at = sizeof *header + header->checkpoints * sizeof *checkpoints + lists_len;
+    if (res == 0)
+        res = write_all(filedesc, header, sizeof *header);
+    if (res == 0)
+        res = write_all(filedesc, checkpoints, header->checkpoints * sizeof *checkpoints);
+    for (size_t i = 0; i < HISTORY_BUCKETS && res == 0; i++)
+        res = write_all(filedesc, lists[i].data, lists[i].len);
+
+    for (size_t i = 0; lists != NULL && i < HISTORY_BUCKETS; i++)
+        free(lists[i].data);
+    free(lists);
+    free(posted);
+    free(checkpoints);
+    return res;
+}
+
+static int rebuild_index(struct stat const* history_st, char const* history) {
+    // written to a new file, so searches still using the old index are not disturbed
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (history_path(path, sizeof path, HISTORY_INDEX) < 0
+            || snprintf(tmp_path, sizeof tmp_path, "%s.XXXXXX", path) >= (int)sizeof tmp_path)
+        return -1;
+    int filedesc = mkstemp(tmp_path);
+    if (filedesc < 0) {
+        printf_debug("DEBUG: Could not create history index \"%s\"\n", tmp_path);
+        return -1;
+    }
+    struct index_header* header = calloc(1, sizeof *header);
+    int res = header == NULL ? -1 : 0;
+    if (res == 0) {
+        memcpy(header->magic, INDEX_MAGIC, sizeof header->magic);
+        header->inode = history_st->st_ino;
+        res = write_lists(filedesc, header, history, history_st->st_size);
+    }
+    if (close(filedesc) == -1 || res < 0 || rename(tmp_path, path) == -1) {
+        printf_debug("DEBUG: Could not write history index\n");
+        unlink(tmp_path);
+        res = -1;
+    }
+    free(header);
+    return res;
+}
+
+static int extend_index(int index_fd, struct index_header* header, char const* history, uint64_t end) {
+    // appends tail postings for the whole lines in history[header->indexed, end), then the header
+    uint32_t posted[HISTORY_BUCKETS] = {0}; // line that last posted to each bucket, one posting per line
+    struct posting batch[256];
+    size_t batch_len = 0;
+    off_t at = header->tail_at + (off_t)header->records * sizeof *batch;
+    char const* line = history + header->indexed;
+    char const* nl;
+    while ((nl = memchr(line, '\n', history + end - line)) != NULL) {
+        ++header->lines;
+        for (char const* pos = line; pos + 3 <= nl; ++pos) {
+            uint32_t bucket = trigram_bucket(pos);
+            if (posted[bucket] == header->lines)
+                continue;
+            posted[bucket] = header->lines;
+            batch[batch_len].offset = line - history;
+            batch[batch_len].number = header->lines;
+            batch[batch_len].next = header->tail_head[bucket];
+            header->tail_head[bucket] = ++header->records;
+            ++header->tail_count[bucket];
+            if (++batch_len == sizeof batch / sizeof *batch) {
+                if (pwrite(index_fd, batch, sizeof batch, at) != sizeof batch) {
+                    printf_debug("DEBUG: Could not write history index\n");
+                    return -1;
+                }
+                at += sizeof batch;
+                batch_len = 0;
+            }
+        }
+        line = nl + 1;
+    }
+    header->indexed = line - history;
+    // the header goes last, a shell killed before it leaves the previous index intact
+    if (pwrite(index_fd, batch, batch_len * sizeof *batch, at) != (ssize_t)(batch_len * sizeof *batch)
+            || pwrite(index_fd, header, sizeof *header, 0) != sizeof *header) {
+        printf_debug("DEBUG: Could not write history index\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int open_index(struct stat const* history_st, char const* history, struct index_header* header) {
+    /* Opens the index covering every whole line of the history, the caller holds an exclusive
+       flock() of the history. RETURN VALUE the index or -1
+    */
+    char path[PATH_MAX];
+    if (history_path(path, sizeof path, HISTORY_INDEX) < 0)
+        return -1;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int index_fd = open(path, O_RDWR | O_CLOEXEC);
+        bool valid = index_fd >= 0
+            && pread(index_fd, header, sizeof *header, 0) == sizeof *header
+            && memcmp(header->magic, INDEX_MAGIC, sizeof header->magic) == 0
+            && header->inode == (uint64_t)history_st->st_ino
+            && header->indexed <= (uint64_t)history_st->st_size;
+        if (valid && history_st->st_size - header->list_bytes <= HISTORY_TAIL_MAX) {
+            if (header->indexed == (uint64_t)history_st->st_size
+                    || extend_index(index_fd, header, history, history_st->st_size) == 0)
+                return index_fd;
+        }
+        // new, from an older version, the history was replaced or truncated, or the tail is full
+        if (index_fd >= 0)
+            close(index_fd);
+        if (attempt > 0 || rebuild_index(history_st, history) < 0)
+            break;
+    }
+    return -1;
+}
+
+// INDEX SEARCH
+struct cursor {
+    uint32_t number; // of the line at 'line', 0 if not set yet
+    char const* line;
+};
+
+static char const* find_line(char const* history, uint64_t const* checkpoints, uint32_t number, struct cursor* cursor) {
+    // lines listed in ascending order are found from the previous one, otherwise from their checkpoint
+    if (cursor->number == 0 || cursor->number > number || number - cursor->number >= HISTORY_CHECKPOINT) {
+        uint32_t checkpoint = (number - 1) / HISTORY_CHECKPOINT;
+        cursor->number = checkpoint * HISTORY_CHECKPOINT + 1;
+        cursor->line = history + checkpoints[checkpoint];
+    }
+    for (; cursor->number < number; ++cursor->number)
+        cursor->line = (char const*)rawmemchr(cursor->line, '\n') + 1;
+    return cursor->line;
+}
+
+static size_t read_list(uint8_t const* list, uint8_t const* end, uint32_t* numbers, size_t max_len) {
+    size_t len = 0;
+    uint32_t number = 0;
+    while (list < end && len < max_len) {
+        uint32_t delta = 0;
+        for (int shift = 0; list < end; shift += 7) {
+            uint8_t byte = *list++;
+            delta |= (uint32_t)(byte & 0x7f) << shift;
+            if (byte < 0x80)
+                break;
+        }
+        number += delta;
+        numbers[len++] = number;
+    }
+    return len;
+}
+
+static bool matches(char const* line, size_t len, char const* pattern) {
+    return pattern == NULL || memmem(line, len, pattern, strlen(pattern)) != NULL;
+}
+
+static bool match_line(char const* line, char const* pattern, size_t* len) {
+    // 'line' is indexed, so it ends with '\n'
+    *len = (char const*)rawmemchr(line, '\n') - line;
+    return matches(line, *len, pattern);
+}
+
+static int search_index(int index_fd, struct index_header const* header, char const* begin, char const* end,
+        char const* pattern, bool reverse, struct output* out) {
+    size_t index_len = header->tail_at + (size_t)header->records * sizeof(struct posting);
+    char const* index = mmap(NULL, index_len, PROT_READ, MAP_SHARED, index_fd, 0);
+    if (index == MAP_FAILED) {
+        printf_debug("DEBUG: mmap() of history index failed\n");
+        return -1;
+    }
+    uint64_t const* checkpoints = (uint64_t const*)(index + sizeof *header);
+    uint8_t const* lists = (uint8_t const*)(checkpoints + header->checkpoints);
+    struct posting const* postings = (struct posting const*)(index + header->tail_at);
+
+    // every match is in the bucket of each of the pattern's trigrams, the one with the fewest lines is walked
+    uint32_t bucket = trigram_bucket(pattern);
+    for (char const* pos = pattern + 1; pos[0] != '\0' && pos[1] != '\0' && pos[2] != '\0'; ++pos) {
+        uint32_t other = trigram_bucket(pos);
+        if (header->list_count[other] + header->tail_count[other] < header->list_count[bucket] + header->tail_count[bucket])
+            bucket = other;
+    }
+
+    // both parts of the bucket are read whole (their lengths are known), oldest line first
+    uint32_t* numbers = malloc((header->list_count[bucket] + 1) * sizeof *numbers);
+    struct posting const** tail = malloc((header->tail_count[bucket] + 1) * sizeof *tail);
+    if (numbers == NULL || tail == NULL) {
+        printf_debug("DEBUG: malloc() failed\n");
+        free(numbers);
+        free(tail);
+        munmap((void*)index, index_len);
+        return -1;
+    }
+    uint8_t const* list = lists + (bucket == 0 ? 0 : header->list_end[bucket - 1]);
+    size_t numbers_len = read_list(list, lists + header->list_end[bucket], numbers, header->list_count[bucket]);
+    size_t tail_len = header->tail_count[bucket];
+    size_t i = tail_len;
+    for (uint32_t next = header->tail_head[bucket]; next != 0 && next <= header->records && i > 0; next = postings[next - 1].next)
+        tail[--i] = &postings[next - 1];
+    tail_len -= i; // an interrupted extension may have left fewer
+    tail += i;
+
+    // a last line without its '\n' is not indexed, it is the newest entry
+    char const* unindexed = begin + header->indexed;
+    bool unindexed_matches = unindexed < end && matches(unindexed, end - unindexed, pattern);
+
+    int res = reverse ? -1 : 0;
+    size_t len;
+    struct cursor cursor = {0};
+    if (reverse) {
+        if (unindexed_matches) {
+            output_line(out, 0, unindexed, end - unindexed);
+            res = 0;
+        }
+        for (size_t j = tail_len; j > 0 && res != 0; --j) {
+            char const* line = begin + tail[j-1]->offset;
+            if (match_line(line, pattern, &len)) {
+                output_line(out, 0, line, len);
+                res = 0;
+            }
+        }
+        for (size_t j = numbers_len; j > 0 && res != 0; --j) {
+            char const* line = find_line(begin, checkpoints, numbers[j-1], &cursor);
+            if (match_line(line, pattern, &len)) {
+                output_line(out, 0, line, len);
+                res = 0;
+            }
+        }
+    } else {
+        for (size_t j = 0; j < numbers_len; j++) {
+            char const* line = find_line(begin, checkpoints, numbers[j], &cursor);
+            if (match_line(line, pattern, &len))
+                output_line(out, numbers[j], line, len);
+        }
+        for (size_t j = 0; j < tail_len; j++) {
+            char const* line = begin + tail[j]->offset;
+            if (match_line(line, pattern, &len))
+                output_line(out, tail[j]->number, line, len);
+        }
+        if (unindexed_matches)
+            output_line(out, header->lines + 1, unindexed, end - unindexed);
+    }
+    free(numbers);
+    free(tail - i);
+    munmap((void*)index, index_len);
+    return res;
+}
+
+static int scan_history(char const* begin, char const* end, char const* pattern, bool reverse, struct output* out) {
+    // listing every entry and patterns shorter than a trigram go through the whole history
+    if (reverse) {
+        char const* line_end = end[-1] == '\n' ? end - 1 : end;
+        while (line_end > begin) {
+            char const* nl = memrchr(begin, '\n', line_end - begin);
+            char const* line = nl == NULL ? begin : nl + 1;
+            if (matches(line, line_end - line, pattern)) {
+                output_line(out, 0, line, line_end - line);
+                return 0;
+            }
+            line_end = nl == NULL ? begin : nl;
+        }
+        return -1; // reverse search fails without a match
+    }
+    unsigned long number = 0;
+    for (char const* line = begin; line < end; ) {
+        char const* nl = memchr(line, '\n', end - line);
+        char const* line_end = nl == NULL ? end : nl;
+        ++number;
+        if (matches(line, line_end - line, pattern))
+            output_line(out, number, line, line_end - line);
+        line = line_end + 1;
+    }
+    return 0;
+}
+
+int history_search(char const* pattern, bool reverse) {
+    /* Prints every entry containing 'pattern' (all entries if NULL) numbered from the oldest,
+       or with 'reverse' only the most recent one.
+    */
+    char path[PATH_MAX];
+    if (history_path(path, sizeof path, HISTORY_FILE) < 0)
+        return -1;
+    int filedesc = open(path, O_RDONLY | O_CLOEXEC);
+    if (filedesc < 0)
+        return reverse ? -1 : 0; // no history yet
+
+    // locked before the history is measured, so no other shell has indexed past its end
+    bool const use_index = pattern != NULL && strlen(pattern) >= 3 && flock(filedesc, LOCK_EX) == 0;
+    struct stat st;
+    if (fstat(filedesc, &st) == -1 || st.st_size == 0) {
+        close(filedesc); // also releases the flock()
+        return reverse ? -1 : 0;
+    }
+    char const* begin = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, filedesc, 0);
+    if (begin == MAP_FAILED) {
+        printf_debug("DEBUG: mmap(%s) failed\n", path);
+        close(filedesc);
+        return -1;
+    }
+    char const* end = begin + st.st_size;
+
+    struct output out = {.len = 0};
+    struct index_header* header = use_index ? malloc(sizeof *header) : NULL;
+    int index_fd = header != NULL ? open_index(&st, begin, header) : -1;
+    int res = 0;
+    if (index_fd >= 0 && flock(filedesc, LOCK_SH) == 0) {
+        res = search_index(index_fd, header, begin, end, pattern, reverse, &out);
+    } else {
+        if (use_index)
+            printf_debug("DEBUG: Could not update history index, scanning the history\n");
+        res = scan_history(begin, end, pattern, reverse, &out);
+    }
+    output_flush(&out);
+    if (index_fd >= 0)
+        close(index_fd);
+    free(header);
+    munmap((void*)begin, st.st_size);
+    close(filedesc); // releases the flock()
+    return res;
+}
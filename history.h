@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+
+#define HISTORY_FILE  ".mysh_history"     // in $HOME
+#define HISTORY_INDEX ".mysh_history.idx" // in $HOME, trigram index of HISTORY_FILE
+#define HISTORY_BUCKETS 4096              // trigram hash buckets of the index, power of 2
+#define HISTORY_CHECKPOINT 32             // lines between the line offsets kept by the index
+#define HISTORY_TAIL_MAX (64 * 1024)      // bytes of new history indexed in place before the index is rewritten
+
+int history_add(char const* line);
+int history_search(char const* pattern, bool reverse);
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE // memfd_create()
+
+#include <linux/limits.h> // PATH_MAX
+#include <fcntl.h> // fcntl()
+#include <inttypes.h> // SCNx64, PRIx64
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h> // memfd_create()
+#include <unistd.h> // fsync(), ftruncate(), getcwd(), chdir(), dup2(), pread()
+#include "debug.h"
+#include "journal.h"
+
+/*
+    Each completed line of a batch file is logged as
+
+        <byte offset> <hash of line> <status> <cwd after line>\n
+
+    A resumed run replays the log in order: a line is skipped if it is at the logged offset
+    and has the logged hash, anything else means the batch file was changed. The log is first
+    cut back to the entries before the first failed line (or a partial entry left by a killed
+    run), so that line and everything after it runs again and is appended as it completes.
+
+    A watch run replays the log of the previous run the same way, but the first changed (or
+    failed) line ends the replay and every line from there on runs again. Its log and the
+    output of its lines are kept in anonymous memory files, so entries also hold the number of
+    bytes the line wrote to stdout and stderr:
+
+        <byte offset> <hash of line> <status> <stdout bytes> <stderr bytes> <cwd after line>\n
+*/
+
+static int const STD_FDS[2] = {STDOUT_FILENO, STDERR_FILENO};
+
+struct entry {
+    long offset;
+    uint64_t hash;
+    int status;
+    long long output[2]; // watch mode only
+    char cwd[PATH_MAX];
+};
+
+uint64_t journal_hash(char const* line) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char const* pos = line; *pos != '\0'; ++pos) {
+        hash ^= (unsigned char)*pos;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int write_entry(struct journal* journal, struct entry const* entry) {
+    fprintf(journal->log, "%ld %016" PRIx64 " %d ", entry->offset, entry->hash, entry->status);
+    if (journal->rewrite)
+        fprintf(journal->log, "%lld %lld ", entry->output[0], entry->output[1]);
+    fprintf(journal->log, "%s\n", entry->cwd);
+
+    // flush every line so a killed shell loses nothing, fsync in batches for power loss
+    if (fflush(journal->log) == EOF) {
+        printf_debug("DEBUG: Could not write journal\n");
+        return -1;
+    }
+    if (++journal->pending >= JOURNAL_SYNC_EVERY) {
+        journal->pending = 0;
+        if (fsync(fileno(journal->log)) == -1) {
+            printf_debug("DEBUG: fsync() failed\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int read_entry(FILE* log, bool rewrite, struct entry* entry) {
+    // RETURN VALUE 0 if a complete entry was read, otherwise -1
+    int matched = fscanf(log, "%ld %" SCNx64 " %d ", &entry->offset, &entry->hash, &entry->status);
+    if (matched == 3 && rewrite)
+        matched += fscanf(log, "%lld %lld ", &entry->output[0], &entry->output[1]);
+    if (matched != (rewrite ? 5 : 3) || fgets(entry->cwd, sizeof entry->cwd, log) == NULL)
+        return -1;
+    size_t len = strlen(entry->cwd);
+    if (entry->cwd[len-1] != '\n')
+        return -1;
+    entry->cwd[len-1] = '\0';
+    return 0;
+}
+
+static long replay_length(FILE* log) {
+    // bytes of the log up to the first failed line or partial entry
+    long length = 0;
+    struct entry entry;
+    while (read_entry(log, false, &entry) == 0 && entry.status == 0)
+        length = ftell(log);
+    rewind(log);
+    return length;
+}
+
+static int copy_output(int from, off_t pos, off_t len, int to) {
+    char buf[4096];
+    while (len > 0) {
+        ssize_t got = pread(from, buf, len < (off_t)sizeof buf ? (size_t)len : sizeof buf, pos);
+        if (got <= 0)
+            return -1;
+        for (ssize_t done = 0; done < got; ) {
+            ssize_t put = write(to, buf + done, got - done);
+            if (put == -1)
+                return -1;
+            done += put;
+        }
+        pos += got;
+        len -= got;
+    }
+    return 0;
+}
+
+static void end_replay(struct journal* journal) {
+    if (journal->replay != NULL)
+        fclose(journal->replay);
+    journal->replay = NULL;
+    for (int i = 0; i < 2; ++i) {
+        if (journal->replay_output[i] != -1)
+            close(journal->replay_output[i]);
+        journal->replay_output[i] = -1;
+    }
+}
+
+int journal_open(struct journal* journal, char const* path, bool resume) {
+    journal->replay = NULL;
+    journal->pending = 0;
+    journal->rewrite = false;
+    for (int i = 0; i < 2; ++i) {
+        journal->output[i] = -1;
+        journal->replay_output[i] = -1;
+        journal->saved[i] = -1;
+    }
+    if (resume) {
+        journal->replay = fopen(path, "r");
+        if (journal->replay == NULL) {
+            printf_debug("DEBUG: Could not open journal \"%s\"\n", path);
+            return -1;
+        }
+    }
+    journal->log = fopen(path, resume ? "a" : "w");
+    if (journal->log == NULL) {
+        printf_debug("DEBUG: Could not open journal \"%s\"\n", path);
+        if (journal->replay != NULL)
+            fclose(journal->replay);
+        return -1;
+    }
+    if (resume && ftruncate(fileno(journal->log), replay_length(journal->replay)) == -1) {
+        printf_debug("DEBUG: Could not truncate journal \"%s\"\n", path);
+        fclose(journal->replay);
+        fclose(journal->log);
+        return -1;
+    }
+    return 0;
+}
+
+int journal_rewrite(struct journal* journal, struct journal* previous) {
+    // watch mode, 'previous' (NULL for the first run) hands over its log and output to be replayed
+    int log_fd = memfd_create("mysh-journal", MFD_CLOEXEC);
+    journal->log = log_fd != -1 ? fdopen(log_fd, "w+") : NULL;
+    journal->replay = NULL;
+    journal->pending = 0;
+    journal->rewrite = true;
+    for (int i = 0; i < 2; ++i) {
+        journal->output[i] = memfd_create("mysh-output", MFD_CLOEXEC);
+        journal->replay_output[i] = -1;
+        journal->saved[i] = -1;
+        journal->captured[i] = 0;
+    }
+    if (previous != NULL) {
+        journal->replay = previous->log;
+        previous->log = NULL;
+        rewind(journal->replay);
+        for (int i = 0; i < 2; ++i) {
+            journal->replay_output[i] = previous->output[i];
+            previous->output[i] = -1;
+            lseek(journal->replay_output[i], 0, SEEK_SET); // the file offset is the replay position
+        }
+        journal_close(previous);
+    }
+    if (journal->log == NULL || journal->output[0] == -1 || journal->output[1] == -1) {
+        printf_debug("DEBUG: Could not create watch journal\n");
+        if (log_fd != -1 && journal->log == NULL)
+            close(log_fd);
+        journal_close(journal);
+        return -1;
+    }
+    return 0;
+}
+
+int journal_skip(struct journal* journal, long offset, uint64_t hash) {
+    /* RETURN VALUE
+        1  - line completed in a previous run, skip it
+        0  - line has to run
+        -1 - line does not match the journal, the batch file was changed
+    */
+    if (journal->replay == NULL)
+        return 0;
+
+    struct entry entry;
+    if (read_entry(journal->replay, journal->rewrite, &entry) < 0 || entry.status != 0) {
+        // end of the log, a partial entry written when the previous run was killed, or a failed line
+        end_replay(journal);
+        return 0;
+    }
+    if ((entry.offset != offset || entry.hash != hash) && journal->rewrite) {
+        end_replay(journal);
+        return 0;
+    } else if (entry.offset != offset || entry.hash != hash) {
+        printf_debug("DEBUG: Batch file changed since the journal was written (offset %ld)\n", offset);
+        return -1;
+    }
+
+    // later lines may depend on a "cd" in a skipped line
+    if (chdir(entry.cwd) == -1) {
+        printf_debug("DEBUG: chdir() failed with arg: \"%s\"\n", entry.cwd);
+        return -1;
+    }
+    if (!journal->rewrite)
+        return 1;
+
+    // show the output of the skipped line again and keep it for the next run
+    for (int i = 0; i < 2; ++i) {
+        off_t pos = lseek(journal->replay_output[i], 0, SEEK_CUR);
+        if (pos == -1
+                || copy_output(journal->replay_output[i], pos, entry.output[i], STD_FDS[i]) < 0
+                || copy_output(journal->replay_output[i], pos, entry.output[i], journal->output[i]) < 0
+                || lseek(journal->replay_output[i], entry.output[i], SEEK_CUR) == -1) {
+            printf_debug("DEBUG: Could not replay output of skipped line\n");
+            return -1;
+        }
+    }
+    if (write_entry(journal, &entry) < 0)
+        return -1;
+    return 1;
+}
+
+int journal_capture(struct journal* journal) {
+    // watch mode, stdout and stderr go to 'output' until journal_release()
+    if (!journal->rewrite)
+        return 0;
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 2; ++i) {
+        journal->captured[i] = lseek(journal->output[i], 0, SEEK_END);
+        journal->saved[i] = fcntl(STD_FDS[i], F_DUPFD_CLOEXEC, 0);
+        if (journal->captured[i] == -1 || journal->saved[i] == -1 || dup2(journal->output[i], STD_FDS[i]) == -1) {
+            printf_debug("DEBUG: Could not capture output\n");
+            journal_release(journal);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int journal_release(struct journal* journal) {
+    // ends journal_capture(), what the line wrote is shown on the real stdout and stderr
+    int res = 0;
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 2; ++i) {
+        if (journal->saved[i] == -1)
+            continue;
+        off_t end = lseek(journal->output[i], 0, SEEK_END);
+        if (dup2(journal->saved[i], STD_FDS[i]) == -1 || end == -1
+                || copy_output(journal->output[i], journal->captured[i], end - journal->captured[i], STD_FDS[i]) < 0)
+            res = -1;
+        journal->captured[i] = end - journal->captured[i];
+        close(journal->saved[i]);
+        journal->saved[i] = -1;
+    }
+    return res;
+}
+
+int journal_record(struct journal* journal, long offset, uint64_t hash, int status) {
+    struct entry entry = {.offset = offset, .hash = hash, .status = status};
+    if (journal->rewrite) {
+        if (journal_release(journal) < 0) {
+            printf_debug("DEBUG: Could not release captured output\n");
+            return -1;
+        }
+        entry.output[0] = journal->captured[0];
+        entry.output[1] = journal->captured[1];
+    }
+    if (getcwd(entry.cwd, sizeof entry.cwd) == NULL) {
+        printf_debug("DEBUG: getcwd() failed\n");
+        return -1;
+    }
+    return write_entry(journal, &entry);
+}
+
+int journal_close(struct journal* journal) {
+    int res = 0;
+    end_replay(journal);
+    if (journal->log != NULL) {
+        if (fflush(journal->log) == EOF || fsync(fileno(journal->log)) == -1)
+            res = -1;
+        if (fclose(journal->log) == EOF)
+            res = -1;
+        journal->log = NULL;
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (journal->output[i] != -1)
+            close(journal->output[i]);
+        journal->output[i] = -1;
+    }
+    return res;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h> // off_t
+
+#define JOURNAL_FLAG "--journal"
+#define RESUME_FLAG  "--resume"
+#define JOURNAL_SYNC_EVERY 64 // fsync() the journal once per this many lines
+
+struct journal {
+    FILE* log;        // append-only log of completed lines
+    FILE* replay;     // previous log being replayed, NULL once exhausted (or not resuming)
+    unsigned pending; // lines logged since the last fsync()
+    bool rewrite;     // watch mode, skipped lines are logged again and a changed line ends the replay
+    // watch mode only, -1 otherwise
+    int output[2];        // stdout and stderr written by the lines of this run
+    int replay_output[2]; // output of the previous run, written again for skipped lines
+    int saved[2];         // real stdout and stderr while a line's output is captured
+    off_t captured[2];    // where the line's output starts in 'output', then its length
+};
+
+uint64_t journal_hash(char const* line);
+
+int journal_open(struct journal* journal, char const* path, bool resume);
+int journal_rewrite(struct journal* journal, struct journal* previous);
+int journal_skip(struct journal* journal, long offset, uint64_t hash);
+int journal_capture(struct journal* journal);
+int journal_release(struct journal* journal);
+int journal_record(struct journal* journal, long offset, uint64_t hash, int status);
+int journal_close(struct journal* journal);
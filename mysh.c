@@ -1,12 +1,20 @@
-#define MAX_LEN 66 // 64 chars + newline + null
-
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h> // realloc(), free()
 #include <string.h>
 #include <unistd.h> // STDERR_FILENO
+#include "complete.h"
 #include "debug.h"
+#include "editor.h"
 #include "exec.h"
+#include "history.h"
+#include "journal.h"
+#include "mysh.h"
+#include "pipeline.h"
+#include "server.h"
 #include "strquote.h"
+#include "watch.h"
 
 const char* PROMPT  = "520shell> ";
 const char* ERROR   = "An ERROR has occurred\n";
@@ -108,8 +116,13 @@ char split_redir(char* src, char* dest_redir) {
 }
 
 size_t split(char* src, char const* delim, char* dest) {
+    // returns the number of tokens, 0 if 'src' is only made of delimiters
     unsigned offset = 0;
     char* token = strtok2(src, delim);
+    if (token == NULL) {
+        *dest = '\0';
+        return 0;
+    }
     size_t count = 1;
     append_cmd(dest, token, &offset);
     while(token != NULL) {
@@ -136,31 +149,248 @@ int buf_to_strs(char* buf, char** dest) {
     return 0;
 }
 
-void flush_input_src(FILE* input_src) {
-    int ch;
-    do {
-        ch = fgetc(input_src);
-        if(input_src != stdin) // print rest of invalid command in batch mode
-            write(STDOUT_FILENO, &ch, 1);
-    } while (ch != '\n' && ch != EOF);
+static void append_rest(struct input_line* line, int ch) {
+    if (line->rest_len == line->rest_cap) {
+        size_t cap = line->rest_cap == 0 ? MAX_LEN : 2 * line->rest_cap;
+        char* rest = realloc(line->rest, cap);
+        if (rest == NULL)
+            return; // the rest is still consumed, only its echo is cut short
+        line->rest = rest;
+        line->rest_cap = cap;
+    }
+    line->rest[line->rest_len++] = ch;
+}
+
+int read_line(FILE* input_src, bool use_editor, struct input_line* line) {
+    /* RETURN VALUE
+        1  - a line was read into 'line'
+        0  - end of input
+        -1 - reading failed
+    */
+    memset(line->buf, 0, sizeof line->buf);
+    line->offset = ftell(input_src);
+    line->missing_newline = false;
+    line->too_long = false;
+    line->rest_len = 0;
+    char* input = use_editor ?
+        editor_read(PROMPT, line->buf, sizeof line->buf) :
+        fgets(line->buf, sizeof line->buf, input_src);
+    if (input == NULL && use_editor) {
+        return 0;
+    } else if (input == NULL) {
+        if (fgetc(input_src) != EOF) {
+            printf_debug("DEBUG: fgets() failed\n"); // likely a file descriptor issue
+            return -1;
+        }
+        return 0;
+    }
+    // check if input is > 64 chars or EOF
+    if (line->buf[strlen(line->buf)-1] != '\n') { // could check other newline chars also
+        int ch = fgetc(input_src);
+        if (ch == EOF) {
+            line->missing_newline = true;
+        } else {
+            // keep the char used to test EOF and the rest of the invalid command, printed by echo_line()
+            line->too_long = true;
+            append_rest(line, ch);
+            do {
+                ch = fgetc(input_src);
+                append_rest(line, ch);
+            } while (ch != '\n' && ch != EOF);
+        }
+    }
+    return 1;
+}
+
+void echo_line(struct input_line const* line, bool batch) {
+    // print cmd if in batch mode
+    if (batch)
+        write(STDOUT_FILENO, line->buf, strlen(line->buf));
+    if (line->missing_newline)
+        write(STDOUT_FILENO, "\n", 1); // print missing newline
+    else if (line->too_long)
+        write(STDOUT_FILENO, line->rest, batch ? line->rest_len : 1); // print rest of invalid command in batch mode
 }
 
 void log_error(void) {
     write(STDERR_FILENO, ERROR, strlen(ERROR));
 }
 
-int main(int argc, char** argv) {
+static struct group* add_group(struct parsed_line* line, char mode) {
+    struct group* group = &line->groups[line->groups_len++];
+    group->mode = mode;
+    group->skip = false;
+    group->errors = 0;
+    group->first = line->cmds_len;
+    group->len = 0;
+    return group;
+}
+
+static struct cmd* add_cmd(struct parsed_line* line, struct group* group, char redir_type) {
+    struct cmd* cmd = &line->cmds[line->cmds_len];
+    memset(cmd, 0, sizeof *cmd);
+    line->f_cmds[line->cmds_len] = cmd->f_strs;
+    line->r_cmds[line->cmds_len] = cmd->r_strs;
+    line->redir_types[line->cmds_len] = redir_type;
+    ++line->cmds_len;
+    ++group->len;
+    return cmd;
+}
+
+static void parse_multi(char* input_buf, char const* delim, struct parsed_line* line) {
+    // parse multiple cmds separated by 'delim', ";" runs them in sequence and "&" in parallel
+    char split_buf[MAX_LEN] = {0}; // temp split cmd buffer
+    size_t len = split(input_buf, delim, split_buf);
+    struct group* group = add_group(line, delim[0]);
+    if (len == 0) {
+        printf_debug("DEBUG: No cmd between '%c' delimiters\n", delim[0]);
+        group->errors = 1;
+        group->skip = true;
+        return;
+    }
+
+    char* _f_ptr = split_buf;
+    for (size_t i = 0; i < len; i++) {
+        char redir_buf[MAX_LEN] = {0}; // temp redirection buffer
+        size_t before_format_len = strlen(_f_ptr) + 1;
+
+        char redir_type = split_redir(_f_ptr, redir_buf);
+        if (redir_type == -1)
+            ++group->errors;
+        struct cmd* cmd = add_cmd(line, group, redir_type);
+
+        // if redirection invalid, set cmd to empty string (won't exec)
+        char* _cmd = redir_type == -1 ? "" : _f_ptr;
+
+        format_cmd(_cmd, cmd->f_buf);
+        format_cmd(redir_buf, cmd->r_buf);
+        buf_to_strs(cmd->f_buf, cmd->f_strs);
+        buf_to_strs(cmd->r_buf, cmd->r_strs);
+        _f_ptr += before_format_len;
+    }
+}
+
+int parse_line(char* input_buf, struct parsed_line* line) {
+    /* Parses 'input_buf' (tokenized in place) into groups of cmds. Errors are only counted here
+       and logged by run_parsed(), so a line can be parsed ahead of the lines still running.
+
+       RETURN VALUE
+        0  - line is valid
+        -1 - line (or part of it) is invalid
+    */
+    line->cmds_len = 0;
+    line->groups_len = 0;
+    int quotes = contains_quotes(input_buf);
+    if (quotes < 0 || contains_valid_quotes(input_buf) < 0) {
+        struct group* group = add_group(line, '\0');
+        group->errors = 1;
+        group->skip = true;
+        return -1;
+    }
+
+    int res = 0;
+    char* seq_mode = strchr2(input_buf, ';');
+    char* par_mode = strchr2(input_buf, '&');
+    if (seq_mode != NULL && par_mode != NULL) {
+        // groups separated by ';' run in sequence, the cmds within a group run in parallel
+        char split_buf[MAX_LEN] = {0}; // temp split group buffer
+        size_t len = split(input_buf, ";", split_buf);
+        if (len == 0) {
+            struct group* group = add_group(line, ';');
+            group->errors = 1;
+            group->skip = true;
+        }
+        char* group = split_buf;
+        for (size_t i = 0; i < len; i++) {
+            size_t group_len = strlen(group) + 1; // parse_multi() modifies the group
+            char const* delim = strchr2(group, '&') != NULL ? "&" : ";";
+            parse_multi(group, delim, line);
+            group += group_len;
+        }
+    } else if (seq_mode != NULL || par_mode != NULL) {
+        // multiple cmds
+        parse_multi(input_buf, seq_mode != NULL ? ";" : "&", line);
+    } else {
+        // single cmd
+        char redir_buf[MAX_LEN] = {0}; // temp redirection buffer
+        struct group* group = add_group(line, '\0');
+        char redir_type = split_redir(input_buf, redir_buf);
+        if (redir_type == -1) {
+            group->errors = 1;
+            group->skip = true;
+            return -1;
+        }
+        struct cmd* cmd = add_cmd(line, group, redir_type);
+        format_cmd(input_buf, cmd->f_buf); // format cmd (+ args)
+        format_cmd(redir_buf, cmd->r_buf); // format redirection info (+ args)
+        buf_to_strs(cmd->f_buf, cmd->f_strs);
+        buf_to_strs(cmd->r_buf, cmd->r_strs);
+        if (redir_type == '>' && cmd->r_strs[1] != NULL) {
+            printf_debug("DEBUG: >1 file redirection arg specified\n");
+            group->errors = 1;
+            group->skip = true;
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < line->groups_len; i++) {
+        if (line->groups[i].errors > 0)
+            res = -1;
+    }
+    return res;
+}
+
+int run_parsed(struct parsed_line* line) {
+    int res = 0;
+    for (size_t i = 0; i < line->groups_len; i++) {
+        struct group const* group = &line->groups[i];
+        for (unsigned j = 0; j < group->errors; j++) {
+            log_error();
+            res = -1;
+        }
+        if (group->skip)
+            continue;
+
+        char*** f_cmds = line->f_cmds + group->first;
+        char*** r_cmds = line->r_cmds + group->first;
+        char const* redir_types = line->redir_types + group->first;
+        int success = 0;
+        if (group->mode == ';')
+            success = exec_cmds_seq(f_cmds, group->len, redir_types, r_cmds);
+        else if (group->mode == '&')
+            success = exec_cmds_par(f_cmds, group->len, redir_types, r_cmds);
+        else
+            success = exec_cmd(f_cmds[0], redir_types[0], r_cmds[0]);
+        if (success == EXEC_BYE)
+            return success; // the groups after "bye" never run
+        if (success < 0) {
+            log_error();
+            res = success;
+        }
+    }
+    return res;
+}
+
+int exec_line(char* input_buf) {
+    struct parsed_line line;
+    parse_line(input_buf, &line);
+    return run_parsed(&line);
+}
+
+int run_shell(struct shell* shell) {
+    /* RETURN VALUE
+        exit code of the shell, interactive mode if 'shell->script' is NULL otherwise batch mode
+    */
+    char const* script = shell->script;
+    struct journal* journal = shell->journal;
+    shell->bye = false;
     int exit_code = 0;
+    bool failed = false; // any line failed
     FILE* input_src = stdin;
-    if (argc > 2) {
-        printf_debug("DEBUG: Too many cmd line args\n");
-        log_error();
-        exit_code = 1;
-    } else if (argc == 2) {
+    if (script != NULL) {
         // batch mode
-        input_src = fopen(argv[1], "r");
+        input_src = fopen(script, "r");
         if (input_src == NULL) {
-            printf_debug("DEBUG: Could not open file \"%s\"\n", argv[1]);
+            printf_debug("DEBUG: Could not open file \"%s\"\n", script);
             log_error();
             exit_code = 1;
         }
@@ -168,140 +398,129 @@ int main(int argc, char** argv) {
     if (exit_code == 0)
         setbuf(input_src, NULL);
 
+    // line editing with tab completion when used from a terminal
+    bool const use_editor = input_src == stdin && !shell->served && editor_enabled();
+    if (use_editor)
+        complete_init();
+    // only lines typed by a user, not piped into mysh or sent by a mysh-client
+    bool const record_history = input_src == stdin && !shell->served && (use_editor || isatty(STDIN_FILENO));
+
     // start mysh main loop
+    struct input_line line = {0};
     while (exit_code == 0 && !feof(input_src)) {
-        // print prompt only in basic shell mode
-        if (input_src == stdin)
+        // print prompt only in basic shell mode, a client's stdin is read like a batch file
+        if (input_src == stdin && !shell->served)
             write(STDOUT_FILENO, PROMPT, strlen(PROMPT));
-        char input_buf[MAX_LEN] = {0};
-        char* input = fgets(input_buf, sizeof input_buf, input_src);
-        int* next_ch_ptr = NULL;
-        int next_ch = 0;
-        if (input == NULL) {
-            next_ch = fgetc(input_src);
-            next_ch_ptr = &next_ch;
-            if (next_ch != EOF) {
-                printf_debug("DEBUG: fgets() failed\n"); // likely a file descriptor issue
-                log_error();
-                exit_code = 1;
-            }
-            break; // end the program (otherwise infinite loop)
+        int read = read_line(input_src, use_editor, &line);
+        if (read < 0) {
+            log_error();
+            exit_code = 1;
         }
-        // print cmd if in batch mode
-        if (input_src != stdin)
-            write(STDOUT_FILENO, input_buf, strlen(input_buf));
-        // check if input is > 64 chars or EOF
-        if (input_buf[strlen(input_buf)-1] != '\n') { // could check other newline chars also
-            if(next_ch_ptr == NULL) { // get next ch from input src if necessary
-                next_ch = fgetc(input_src);
-                next_ch_ptr = &next_ch;
-            }
-            if (next_ch == EOF) {
-                write(STDOUT_FILENO, "\n", 1); // print missing newline
-            } else {
-                write(STDOUT_FILENO, next_ch_ptr, 1); // print char used to test EOF or else it will be lost
-                flush_input_src(input_src);
-                printf_debug("DEBUG: Input >64 characters\n");
+        if (read <= 0)
+            break; // end the program (otherwise infinite loop)
+
+        // skip lines completed in a previous run (resume mode)
+        uint64_t hash = journal_hash(line.buf);
+        if (journal != NULL) {
+            int skip = journal_skip(journal, line.offset, hash);
+            if (skip < 0) {
                 log_error();
+                exit_code = 1;
+                break;
+            } else if (skip == 1) {
                 continue;
             }
         }
-
-        int quotes = contains_quotes(input_buf);
-        if (quotes < 0 || contains_valid_quotes(input_buf) < 0) {
+        // watch mode keeps what the line writes so it can be shown again when the line is skipped
+        if (journal != NULL && journal_capture(journal) < 0) {
             log_error();
-            continue;
+            exit_code = 1;
+            break;
         }
-
-        char* seq_mode = strchr2(input_buf, ';');
-        char* par_mode = strchr2(input_buf, '&');
-        if (seq_mode != NULL && par_mode != NULL) {
-            printf_debug("DEBUG: Cannot mix '&' and ';'\n");
+        echo_line(&line, input_src != stdin);
+        if (line.too_long) {
+            printf_debug("DEBUG: Input >64 characters\n");
             log_error();
-            continue;
-        } else if (seq_mode != NULL || par_mode != NULL) {
-            // exec multiple cmds
-            char split_buf[MAX_LEN] = {0}; // temp split cmd buffer
-            char* delim = seq_mode != NULL ? ";" : "&";
-            size_t len = split(input_buf, delim, split_buf);
-
-            // command (+ args) buffers
-            char   _f_bufs[len][MAX_LEN];   // formatted char buffers
-            char*  _f_strs[len][MAX_LEN/2]; // formatted string buffers
-            char** _f_cmds[len];            // formatted multi-cmd buffer
-            memset(_f_bufs, 0, sizeof _f_bufs);
-            memset(_f_strs, 0, sizeof _f_strs);
-            memset(_f_cmds, 0, sizeof _f_cmds);
-
-            // redirection (+ args) buffers
-            char   _r_bufs[len][MAX_LEN];   // redirection char buffers
-            char*  _r_strs[len][MAX_LEN/2]; // redirection string buffers
-            char** _r_cmds[len];            // redirection multi-cmd buffer
-            memset(_r_bufs, 0, sizeof _r_bufs);
-            memset(_r_strs, 0, sizeof _r_strs);
-            memset(_r_cmds, 0, sizeof _r_cmds);
-
-            // redirection array
-            char redir_types[len];
-            memset(redir_types, 0, sizeof redir_types);
-
-            char* _f_ptr = split_buf;
-            int i = len;
-            while (i>0) {
-                char redir_buf[MAX_LEN] = {0}; // temp redirection buffer
-                size_t before_format_len = strlen(_f_ptr) + 1;
-
-                char redir_type = split_redir(_f_ptr, redir_buf);
-                if (redir_type == -1)
-                    log_error();
-                redir_types[len-i] = redir_type;
-
-                // if redirection invalid, set cmd to empty string (won't exec)
-                char* _cmd = redir_type == -1 ? "" : _f_ptr;
-                    
-                format_cmd(_cmd, _f_bufs[len-i]);
-                format_cmd(redir_buf, _r_bufs[len-i]);
-                buf_to_strs(_f_bufs[len-i], _f_strs[len-i]);
-                buf_to_strs(_r_bufs[len-i], _r_strs[len-i]);
-                _f_cmds[len-i] = _f_strs[len-i];
-                _r_cmds[len-i] = _r_strs[len-i];
-                _f_ptr += before_format_len;
-                --i;
-            }
-
-            int res = 0;
-            if (seq_mode != NULL)
-                res = exec_cmds_seq(_f_cmds, len, redir_types, _r_cmds);
-            else
-                res = exec_cmds_par(_f_cmds, len, redir_types, _r_cmds);
-            if (res < 0)
-                log_error();
-        } else {
-            // exec single cmd
-            char  redir_buf[MAX_LEN] = {0}; // temp redirection buffer
-            char  _f_buf[MAX_LEN] = {0};    // formatted char buffer
-            char* _f_str[MAX_LEN/2] = {0};  // formatted string buffer
-            char  _r_buf[MAX_LEN] = {0};    // redirection char buffer
-            char* _r_str[MAX_LEN/2] = {0};  // redirection string buffer
-
-            char redir_type = split_redir(input_buf, redir_buf);
-            if (redir_type == -1) {
-                log_error();
-                continue;
-            }
-            format_cmd(input_buf, _f_buf); // format cmd (+ args)
-            format_cmd(redir_buf, _r_buf); // format redirection info (+ args)
-            buf_to_strs(_f_buf, _f_str);
-            buf_to_strs(_r_buf, _r_str);
-            if (redir_type == '>' && _r_str[1] != NULL) {
-                printf_debug("DEBUG: >1 file redirection arg specified\n");
+        }
+        char input_buf[MAX_LEN];
+        strcpy(input_buf, line.buf); // exec_line() tokenizes input_buf in place
+        int res = line.too_long ? -1 : exec_line(input_buf);
+        if (res == EXEC_BYE) {
+            // not logged, a resumed run ends at the same "bye"
+            if (journal != NULL && journal_release(journal) < 0) {
                 log_error();
-                continue;
+                exit_code = 1;
             }
-            int res = exec_cmd(_f_str, redir_type, _r_str);
-            if (res < 0)
-                log_error();
+            shell->bye = true;
+            break;
+        }
+        failed |= res < 0;
+        if (record_history && !line.too_long && strcmp(line.buf, "\n") != 0)
+            history_add(line.buf); // added after running so "history" does not find itself
+        if (journal != NULL && journal_record(journal, line.offset, hash, res) < 0) {
+            log_error();
+            exit_code = 1;
         }
     }
+    free(line.rest);
+    if (input_src != NULL && input_src != stdin)
+        fclose(input_src);
+    if (shell->served && failed && exit_code == 0)
+        exit_code = 1; // the client's caller can tell the lines did not all succeed
     return exit_code;
 }
+
+int mysh(char const* script) {
+    struct shell shell = {.script = script, .journal = NULL};
+    return run_shell(&shell);
+}
+
+static int mysh_served(char const* script) {
+    struct shell shell = {.script = script, .journal = NULL, .served = true};
+    return run_shell(&shell);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], SERVER_FLAG) == 0) {
+        // server mode
+        if (serve(argv[2], mysh_served) < 0) {
+            log_error();
+            return 1;
+        }
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], WATCH_FLAG) == 0) {
+        // batch mode, rerun from the first changed line whenever the script changes
+        if (watch(argv[2], run_shell) < 0) {
+            log_error();
+            return 1;
+        }
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], PIPELINE_FLAG) == 0) {
+        // batch mode, the next lines are read and parsed while the current one runs
+        return run_pipelined(argv[2]);
+    }
+    if (argc == 4 && (strcmp(argv[1], JOURNAL_FLAG) == 0 || strcmp(argv[1], RESUME_FLAG) == 0)) {
+        // batch mode with a journal
+        struct journal journal;
+        if (journal_open(&journal, argv[2], strcmp(argv[1], RESUME_FLAG) == 0) < 0) {
+            log_error();
+            return 1;
+        }
+        struct shell shell = {.script = argv[3], .journal = &journal};
+        int exit_code = run_shell(&shell);
+        if (journal_close(&journal) < 0 && exit_code == 0) {
+            printf_debug("DEBUG: Could not close journal\n");
+            log_error();
+            exit_code = 1;
+        }
+        return exit_code;
+    }
+    if (argc > 2) {
+        printf_debug("DEBUG: Too many cmd line args\n");
+        log_error();
+        return 1;
+    }
+    return mysh(argc == 2 ? argv[1] : NULL);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define MAX_LEN 66 // 64 chars + newline + null
+#define MAX_CMDS (MAX_LEN/2) // cmds on one line, separated by ';' or '&'
+
+struct cmd {
+    char  f_buf[MAX_LEN];    // formatted char buffer
+    char* f_strs[MAX_LEN/2]; // formatted string buffer
+    char  r_buf[MAX_LEN];    // redirection char buffer
+    char* r_strs[MAX_LEN/2]; // redirection string buffer
+};
+
+struct group {
+    char     mode;   // '\0' single cmd, ';' cmds in sequence, '&' cmds in parallel
+    bool     skip;   // invalid group, only its errors are logged
+    unsigned errors; // errors logged before the group runs
+    size_t   first;  // index of the group's first cmd
+    size_t   len;    // number of cmds in the group
+};
+
+struct parsed_line {
+    struct cmd   cmds[MAX_CMDS];
+    char**       f_cmds[MAX_CMDS];      // formatted multi-cmd buffer
+    char**       r_cmds[MAX_CMDS];      // redirection multi-cmd buffer
+    char         redir_types[MAX_CMDS]; // redirection array
+    struct group groups[MAX_CMDS];      // run one after another
+    size_t       cmds_len;
+    size_t       groups_len;
+};
+
+struct input_line {
+    char   buf[MAX_LEN];
+    long   offset;          // of the line in the input source
+    bool   missing_newline; // last line of the input source has no newline
+    bool   too_long;        // >64 chars, the chars after the first 64 are in 'rest'
+    char*  rest;
+    size_t rest_len;
+    size_t rest_cap;
+};
+
+struct journal;
+
+struct shell {
+    char const* script;      // batch file, NULL for interactive mode
+    struct journal* journal; // batch mode only, NULL or completed lines are logged and skipped
+    bool served;             // run for a mysh-client: no prompt, exit code 1 if any line failed
+    bool bye;                // set if the shell was ended by "bye"
+};
+
+extern const char* PROMPT;
+
+void log_error(void);
+
+int read_line(FILE* input_src, bool use_editor, struct input_line* line);
+void echo_line(struct input_line const* line, bool batch);
+
+int parse_line(char* input_buf, struct parsed_line* line);
+int run_parsed(struct parsed_line* line);
+int exec_line(char* input_buf);
+int run_shell(struct shell* shell);
@@ -0,0 +1,151 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h> // calloc(), free()
+#include <string.h>
+#include <unistd.h> // write()
+#include "debug.h"
+#include "exec.h"
+#include "mysh.h"
+#include "pipeline.h"
+
+/*
+    A reader thread reads, validates and parses the lines of a batch file into a bounded ring of
+    stages while the main thread runs them in order. The reader never writes: the echo of a line,
+    its parse errors and (in debug builds) the diagnostics explaining them are kept in its stage
+    and printed by the main thread right before the line runs, exactly as in the regular batch mode.
+*/
+
+struct stage {
+    int read; // read_line() result
+    struct input_line input;
+    struct parsed_line parsed;
+    char* diagnostics; // printf_debug() output of reading and parsing the line, NULL if none
+    size_t diagnostics_len;
+};
+
+struct pipeline {
+    FILE* input_src;
+    struct stage stages[PIPELINE_DEPTH];
+    size_t head; // next stage to run
+    size_t tail; // next stage to fill
+    bool stop;   // "bye" ran, the reader stops reading ahead
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+static void* read_ahead(void* arg) {
+    struct pipeline* pipeline = arg;
+    int read = 1;
+    while (read == 1) {
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->tail - pipeline->head == PIPELINE_DEPTH && !pipeline->stop)
+            pthread_cond_wait(&pipeline->not_full, &pipeline->lock);
+        struct stage* stage = &pipeline->stages[pipeline->tail % PIPELINE_DEPTH];
+        bool const stop = pipeline->stop;
+        pthread_mutex_unlock(&pipeline->lock);
+        if (stop)
+            break;
+
+#ifdef DEBUG
+        debug_stream = open_memstream(&stage->diagnostics, &stage->diagnostics_len);
+#endif
+        read = read_line(pipeline->input_src, false, &stage->input);
+        if (read == 1 && !stage->input.too_long) {
+            char input_buf[MAX_LEN];
+            strcpy(input_buf, stage->input.buf); // parse_line() tokenizes input_buf in place
+            parse_line(input_buf, &stage->parsed);
+        }
+        stage->read = read;
+#ifdef DEBUG
+        if (debug_stream != NULL)
+            fclose(debug_stream);
+        debug_stream = NULL;
+#endif
+
+        pthread_mutex_lock(&pipeline->lock);
+        ++pipeline->tail;
+        pthread_cond_signal(&pipeline->not_empty);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+    return NULL;
+}
+
+int run_pipelined(char const* script) {
+    FILE* input_src = fopen(script, "r");
+    if (input_src == NULL) {
+        printf_debug("DEBUG: Could not open file \"%s\"\n", script);
+        log_error();
+        return 1;
+    }
+    setbuf(input_src, NULL);
+
+    struct pipeline* pipeline = calloc(1, sizeof *pipeline);
+    pthread_t reader;
+    if (pipeline == NULL) {
+        printf_debug("DEBUG: calloc() failed\n");
+        log_error();
+        fclose(input_src);
+        return 1;
+    }
+    pipeline->input_src = input_src;
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->not_empty, NULL);
+    pthread_cond_init(&pipeline->not_full, NULL);
+    if (pthread_create(&reader, NULL, read_ahead, pipeline) != 0) {
+        printf_debug("DEBUG: pthread_create() failed\n");
+        log_error();
+        free(pipeline);
+        fclose(input_src);
+        return 1;
+    }
+
+    int exit_code = 0;
+    int read = 1;
+    while (read == 1) {
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->tail == pipeline->head)
+            pthread_cond_wait(&pipeline->not_empty, &pipeline->lock);
+        struct stage* stage = &pipeline->stages[pipeline->head % PIPELINE_DEPTH];
+        pthread_mutex_unlock(&pipeline->lock);
+
+        read = stage->read;
+        if (read == 1)
+            echo_line(&stage->input, true);
+        if (stage->diagnostics != NULL) {
+            write(STDERR_FILENO, stage->diagnostics, stage->diagnostics_len);
+            free(stage->diagnostics);
+            stage->diagnostics = NULL;
+        }
+        if (read < 0) {
+            log_error();
+            exit_code = 1;
+        } else if (read == 1) {
+            if (stage->input.too_long) {
+                printf_debug("DEBUG: Input >64 characters\n");
+                log_error();
+            } else if (run_parsed(&stage->parsed) == EXEC_BYE) {
+                read = 0; // the lines read ahead never run
+            }
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        ++pipeline->head;
+        pipeline->stop = read != 1;
+        pthread_cond_signal(&pipeline->not_full);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    pthread_join(reader, NULL);
+    for (size_t i = 0; i < PIPELINE_DEPTH; i++) {
+        free(pipeline->stages[i].input.rest);
+        free(pipeline->stages[i].diagnostics);
+    }
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->not_empty);
+    pthread_cond_destroy(&pipeline->not_full);
+    free(pipeline);
+    fclose(input_src);
+    return exit_code;
+}
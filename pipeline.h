@@ -0,0 +1,6 @@
+#pragma once
+
+#define PIPELINE_FLAG  "--pipeline"
+#define PIPELINE_DEPTH 16 // lines read and parsed ahead of the running line
+
+int run_pipelined(char const* script);
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE // accept4()
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h> // exit()
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h> // stat(), S_ISSOCK
+#include <sys/un.h>
+#include <unistd.h> // chdir(), dup2(), fork(), unlink()
+#include "debug.h"
+#include "server.h"
+
+static int send_status(int sock, int status) {
+    if (write(sock, &status, sizeof status) != sizeof status)
+        printf_debug("DEBUG: Could not send exit status to client\n");
+    close(sock);
+    return status;
+}
+
+static int set_addr(struct sockaddr_un* addr, char const* path) {
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr->sun_path) {
+        printf_debug("DEBUG: Socket path too long: \"%s\"\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// MESSAGES
+int send_request(int sock, int const fds[SERVER_NFDS], char const* msg, size_t len) {
+    struct iovec iov = { .iov_base = (char*)msg, .iov_len = len };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * SERVER_NFDS)];
+        struct cmsghdr align;
+    } ctrl;
+    memset(&ctrl, 0, sizeof ctrl);
+
+    struct msghdr hdr = {0};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof ctrl.buf;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * SERVER_NFDS);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * SERVER_NFDS);
+
+    if (sendmsg(sock, &hdr, 0) != (ssize_t)len) {
+        printf_debug("DEBUG: sendmsg() failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int recv_request(int sock, int fds[SERVER_NFDS], char* msg, size_t len) {
+    struct iovec iov = { .iov_base = msg, .iov_len = len - 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * SERVER_NFDS)];
+        struct cmsghdr align;
+    } ctrl;
+
+    struct msghdr hdr = {0};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof ctrl.buf;
+
+    ssize_t received = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+    if (received <= 0) {
+        printf_debug("DEBUG: recvmsg() failed\n");
+        return -1;
+    }
+    msg[received] = '\0';
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    if (
+        cmsg == NULL ||
+        cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * SERVER_NFDS)
+    ) {
+        printf_debug("DEBUG: Request did not contain %d file descriptors\n", SERVER_NFDS);
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * SERVER_NFDS);
+
+    // message is "<cwd>\0<script path or empty>\0"
+    if (strlen(msg) + 1 >= (size_t)received) {
+        printf_debug("DEBUG: Malformed request\n");
+        return -1;
+    }
+    return 0;
+}
+
+// CLIENT
+int server_connect(char const* path) {
+    struct sockaddr_un addr;
+    if (set_addr(&addr, path) < 0)
+        return -1;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        printf_debug("DEBUG: socket() failed\n");
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr*)&addr, sizeof addr) == -1) {
+        printf_debug("DEBUG: connect(%s) failed\n", path);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// SERVER
+static int handle_client(int sock, int (*run)(char const* script)) {
+    // exec.c waits for its own children, undo the server's SIG_IGN
+    signal(SIGCHLD, SIG_DFL);
+
+    int fds[SERVER_NFDS];
+    char msg[SERVER_MSG_MAX];
+    if (recv_request(sock, fds, msg, sizeof msg) < 0)
+        return send_status(sock, 1);
+
+    // the client's stdio becomes the stdio of the shell
+    for (int i = 0; i < SERVER_NFDS; i++) {
+        if (dup2(fds[i], i) == -1) {
+            printf_debug("DEBUG: dup2() failed\n");
+            return send_status(sock, 1);
+        }
+        close(fds[i]);
+    }
+
+    char const* cwd = msg;
+    char const* script = msg + strlen(msg) + 1;
+    if (chdir(cwd) == -1) {
+        printf_debug("DEBUG: chdir() failed with arg: \"%s\"\n", cwd);
+        return send_status(sock, 1);
+    }
+    return send_status(sock, run(*script == '\0' ? NULL : script)); // "bye" returns from run() too
+}
+
+int serve(char const* path, int (*run)(char const* script)) {
+    struct sockaddr_un addr;
+    if (set_addr(&addr, path) < 0)
+        return -1;
+
+    // remove the socket left behind by a previous server, never a regular file
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        printf_debug("DEBUG: socket() failed\n");
+        return -1;
+    }
+    if (bind(sock, (struct sockaddr*)&addr, sizeof addr) == -1 || listen(sock, SOMAXCONN) == -1) {
+        printf_debug("DEBUG: Could not listen on \"%s\"\n", path);
+        close(sock);
+        return -1;
+    }
+
+    // every client gets its own process (and therefore its own cwd), which is never waited for
+    signal(SIGCHLD, SIG_IGN);
+    while (true) {
+        int client = accept4(sock, NULL, NULL, SOCK_CLOEXEC); // cmds run by the shell must not inherit it
+        if (client == -1) {
+            if (errno == EINTR)
+                continue;
+            printf_debug("DEBUG: accept() failed\n");
+            close(sock);
+            return -1;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            printf_debug("DEBUG: fork() failed\n");
+        } else if (pid == 0) {
+            // child
+            close(sock);
+            exit(handle_client(client, run));
+        }
+        close(client);
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <linux/limits.h> // PATH_MAX
+
+#define SERVER_FLAG "-s"
+#define SERVER_NFDS 3 // stdin, stdout and stderr of the client
+#define SERVER_MSG_MAX (2 * PATH_MAX) // cwd + '\0' + script path + '\0'
+
+int serve(char const* path, int (*run)(char const* script));
+
+int server_connect(char const* path);
+int send_request(int sock, int const fds[SERVER_NFDS], char const* msg, size_t len);
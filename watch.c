@@ -0,0 +1,72 @@
+#include <linux/limits.h> // PATH_MAX
+#include <fcntl.h> // open()
+#include <libgen.h> // dirname()
+#include <stdbool.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h> // fchdir(), read()
+#include "debug.h"
+#include "journal.h"
+#include "mysh.h"
+#include "watch.h"
+
+static int wait_for_change(int inotify_fd, char const* name) {
+    // events for the whole directory, editors usually replace the file instead of writing to it
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t len = read(inotify_fd, buf, sizeof buf);
+        if (len <= 0) {
+            printf_debug("DEBUG: Could not read inotify events\n");
+            return -1;
+        }
+        for (char* pos = buf; pos < buf + len; ) {
+            struct inotify_event const* event = (struct inotify_event const*)pos;
+            if (event->len > 0 && strcmp(event->name, name) == 0)
+                return 0;
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+int watch(char const* script, int (*run)(struct shell* shell)) {
+    // every run starts in the directory mysh was started in
+    int start_dir = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    char dir[PATH_MAX];
+    strncpy(dir, script, sizeof dir - 1);
+    dir[sizeof dir - 1] = '\0';
+    char const* name = strrchr(script, '/') != NULL ? strrchr(script, '/') + 1 : script;
+
+    int inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (start_dir == -1 || inotify_fd == -1) {
+        printf_debug("DEBUG: Could not set up watch mode\n");
+        return -1;
+    }
+    if (inotify_add_watch(inotify_fd, name == script ? "." : dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        printf_debug("DEBUG: inotify_add_watch() failed\n");
+        return -1;
+    }
+
+    // the journal of a run is replayed by the next one, both only live in memory
+    struct journal runs[2];
+    struct journal* previous = NULL;
+    int exit_code = 0;
+    for (unsigned count = 0; exit_code == 0; ++count) {
+        struct journal* journal = &runs[count % 2];
+        if (fchdir(start_dir) == -1 || journal_rewrite(journal, previous) < 0) {
+            exit_code = -1;
+            break;
+        }
+        struct shell shell = {.script = script, .journal = journal};
+        int run_code = run(&shell);
+        previous = journal;
+        if (shell.bye) // "bye" ends watch mode too
+            break;
+        if (wait_for_change(inotify_fd, name) < 0)
+            exit_code = -1;
+        else if (run_code != 0) // script could not be opened, it may be back after the change
+            printf_debug("DEBUG: Run failed with exit code %d\n", run_code);
+    }
+    if (previous != NULL)
+        journal_close(previous);
+    return exit_code;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "mysh.h"
+
+#define WATCH_FLAG "--watch"
+
+int watch(char const* script, int (*run)(struct shell* shell));